@@ -0,0 +1,11 @@
+; r0 = 3^10 in every thread, i counts the iterations in global memory
+ADD r0, r0, 1
+DEF x SHARED 0 TIDX
+DEF i GLOBAL 0 TIDX
+DEF z LOCAL 10 2
+LOOP:
+MUL r0, r0, 3
+ADD i, i, 1
+CMP_LT i, z
+JMP LOOP
+HALT
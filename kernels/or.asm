@@ -0,0 +1,4 @@
+DEF p SHARED 7 TIDX
+DEF i GLOBAL 4 TIDX
+OR r1, p, i
+HALT
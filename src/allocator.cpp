@@ -0,0 +1,330 @@
+#include "allocator.hpp"
+#include "gpu.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t roundUp(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+DeviceAllocator::DeviceAllocator(size_t bytes) : limit(bytes)
+{
+    clear();
+}
+
+void DeviceAllocator::clear()
+{
+    freeRanges.clear();
+    if (limit > ALIGN) freeRanges[ALIGN] = limit - ALIGN;
+    pools.assign(classOf(MAX_SMALL) + 1, {});
+    live.clear();
+    arena.clear();
+    generation = 0;
+    inUse = 0;
+    temp = 0;
+}
+
+// Size class 0 is MIN_CLASS bytes, each one after it twice the last.
+int DeviceAllocator::classOf(size_t bytes)
+{
+    int c = 0;
+    for (size_t size = MIN_CLASS; size < bytes; size *= 2) c++;
+    return c;
+}
+
+// First fit. Ranges start on ALIGN and sizes are multiples of it, so
+// with the default alignment the result never needs padding.
+DevicePtr DeviceAllocator::takeRange(size_t bytes, size_t align)
+{
+    for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+        const DevicePtr start = roundUp(it->first, align);
+        const size_t pad = start - it->first;
+        if (pad > it->second || it->second - pad < bytes) continue;
+        const DevicePtr rangeStart = it->first;
+        const size_t rest = it->second - pad - bytes;
+        freeRanges.erase(it);
+        if (pad) freeRanges[rangeStart] = pad;
+        if (rest) freeRanges[start + bytes] = rest;
+        return start;
+    }
+    throw std::bad_alloc();
+}
+
+void DeviceAllocator::giveRange(DevicePtr start, size_t bytes)
+{
+    auto next = freeRanges.lower_bound(start);
+    if (next != freeRanges.end() && start + bytes == next->first) {
+        bytes += next->second;
+        next = freeRanges.erase(next);
+    }
+    if (next != freeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start) {
+            prev->second += bytes;
+            return;
+        }
+    }
+    freeRanges[start] = bytes;
+}
+
+DevicePtr DeviceAllocator::allocate(size_t bytes)
+{
+    if (bytes > limit) throw std::bad_alloc();
+    if (bytes <= MAX_SMALL) {
+        const int c = classOf(bytes);
+        const size_t size = MIN_CLASS << c;
+        auto& pool = pools[c];
+        if (pool.empty()) {
+            // chunks stay with their class once carved up
+            const DevicePtr chunk = takeRange(CHUNK);
+            for (size_t off = CHUNK; off >= size; off -= size) pool.push_back(chunk + off - size);
+        }
+        const DevicePtr ptr = pool.back();
+        pool.pop_back();
+        live[ptr] = size;
+        inUse += size;
+        return ptr;
+    }
+    const size_t size = roundUp(bytes, ALIGN);
+    const DevicePtr ptr = takeRange(size);
+    live[ptr] = size;
+    inUse += size;
+    return ptr;
+}
+
+DevicePtr DeviceAllocator::allocateAligned(size_t bytes, size_t align)
+{
+    if (bytes > limit) throw std::bad_alloc();
+    const size_t size = std::max(roundUp(bytes, align), MAX_SMALL + ALIGN);
+    const DevicePtr ptr = takeRange(size, align);
+    live[ptr] = size;
+    inUse += size;
+    return ptr;
+}
+
+void DeviceAllocator::release(DevicePtr ptr)
+{
+    auto it = live.find(ptr);
+    if (it == live.end()) throw std::invalid_argument("deviceFree: " + std::to_string(ptr) + " is not allocated");
+    const size_t size = it->second;
+    live.erase(it);
+    inUse -= size;
+    // large sizes are multiples of ALIGN above MAX_SMALL, so never a class size
+    if (size <= MAX_SMALL) pools[classOf(size)].push_back(ptr);
+    else giveRange(ptr, size);
+}
+
+DevicePtr DeviceAllocator::allocateTemp(size_t bytes)
+{
+    if (bytes > limit) throw std::bad_alloc();
+    const size_t size = roundUp(bytes ? bytes : 1, MIN_CLASS);
+    if (arena.empty() || arena.back().generation != generation || arena.back().used + size > arena.back().bytes) {
+        const size_t chunk = std::max(CHUNK, roundUp(size, ALIGN));
+        arena.push_back({takeRange(chunk), chunk, 0, generation});
+    }
+    ArenaChunk& top = arena.back();
+    const DevicePtr ptr = top.start + top.used;
+    top.used += size;
+    temp += size;
+    return ptr;
+}
+
+uint64_t DeviceAllocator::newLaunch(uint64_t keepFrom)
+{
+    const uint64_t before = std::min(generation, keepFrom);
+    size_t keep = 0;
+    for (const auto& chunk : arena) {
+        if (chunk.generation < before) {
+            giveRange(chunk.start, chunk.bytes);
+            temp -= chunk.used;
+        } else {
+            arena[keep++] = chunk;
+        }
+    }
+    arena.resize(keep);
+    return generation++;
+}
+
+void DeviceAllocator::releaseTemps()
+{
+    for (const auto& chunk : arena) giveRange(chunk.start, chunk.bytes);
+    arena.clear();
+    temp = 0;
+}
+
+void DeviceAllocator::save(std::string& out) const
+{
+    put(out, static_cast<uint64_t>(freeRanges.size()));
+    for (const auto& [start, bytes] : freeRanges) {
+        put(out, static_cast<uint64_t>(start));
+        put(out, static_cast<uint64_t>(bytes));
+    }
+    for (const auto& pool : pools) {
+        put(out, static_cast<uint64_t>(pool.size()));
+        putArray(out, pool.data(), pool.size());
+    }
+    put(out, static_cast<uint64_t>(live.size()));
+    for (const auto& [ptr, bytes] : live) {
+        put(out, static_cast<uint64_t>(ptr));
+        put(out, static_cast<uint64_t>(bytes));
+    }
+    put(out, static_cast<uint64_t>(arena.size()));
+    putArray(out, arena.data(), arena.size());
+    put(out, generation);
+    put(out, static_cast<uint64_t>(inUse));
+    put(out, static_cast<uint64_t>(temp));
+}
+
+bool DeviceAllocator::load(Reader& in)
+{
+    // a count is only trusted if that many entries can still follow
+    auto count = [&](uint64_t& n, size_t entry) {
+        return in.get(n) && n <= static_cast<uint64_t>(in.end - in.p) / entry;
+    };
+    uint64_t n, a, b;
+    freeRanges.clear();
+    live.clear();
+    if (!count(n, 2 * sizeof(uint64_t))) return false;
+    for (uint64_t i = 0; i < n; i++) {
+        if (!in.get(a) || !in.get(b)) return false;
+        freeRanges[a] = static_cast<size_t>(b);
+    }
+    for (auto& pool : pools) {
+        if (!count(n, sizeof(DevicePtr))) return false;
+        pool.resize(n);
+        if (!in.getArray(pool.data(), pool.size())) return false;
+    }
+    if (!count(n, 2 * sizeof(uint64_t))) return false;
+    for (uint64_t i = 0; i < n; i++) {
+        if (!in.get(a) || !in.get(b)) return false;
+        live[a] = static_cast<size_t>(b);
+    }
+    if (!count(n, sizeof(ArenaChunk))) return false;
+    arena.resize(n);
+    if (!in.getArray(arena.data(), arena.size()) || !in.get(generation) || !in.get(a) || !in.get(b)) return false;
+    inUse = static_cast<size_t>(a);
+    temp = static_cast<size_t>(b);
+    return true;
+}
+
+DevicePtr GPU::deviceMalloc(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return allocator.allocate(bytes);
+}
+
+void GPU::deviceFree(DevicePtr ptr)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    allocator.release(ptr);
+}
+
+DevicePtr GPU::deviceMallocTemp(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return allocator.allocateTemp(bytes);
+}
+
+void GPU::releaseTemps()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    allocator.releaseTemps();
+}
+
+float* GPU::hostPointer(DevicePtr ptr)
+{
+    if (ptr % sizeof(float) || ptr >= global_memory.size() * sizeof(float))
+        throw std::out_of_range("hostPointer: " + std::to_string(ptr) + " is not a word in global memory");
+    return global_memory.data() + ptr / sizeof(float);
+}
+
+// A page-aligned range of global memory for a mapping of `bytes`.
+DevicePtr GPU::mappingRange(const char* what, size_t bytes)
+{
+    try {
+        return allocator.allocateAligned(bytes, DeviceMemory::pageSize());
+    } catch (const std::bad_alloc&) {
+        throw std::runtime_error(std::string(what) + ": no free range of " + std::to_string(bytes) +
+                                 " bytes in global memory");
+    }
+}
+
+DevicePtr GPU::mapFile(const std::string& path, MapMode mode, size_t offset, size_t bytes)
+{
+    const bool write = mode == MapMode::WriteBack;
+    int fd = ::open(path.c_str(), write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) throw std::runtime_error("mapFile: cannot open " + path + ": " + std::strerror(errno));
+    struct stat st;
+    bool ok = ::fstat(fd, &st) == 0;
+    const size_t size = ok ? static_cast<size_t>(st.st_size) : 0;
+    if (ok && bytes == 0) bytes = size > offset ? size - offset : 0;
+    if (ok && offset + bytes > size) {
+        // outputs grow to fit; inputs must already hold the range
+        ok = write && ::ftruncate(fd, static_cast<off_t>(offset + bytes)) == 0;
+    }
+    if (!ok || bytes == 0) {
+        ::close(fd);
+        throw std::runtime_error("mapFile: " + path + " does not hold " + std::to_string(bytes) +
+                                 " bytes from offset " + std::to_string(offset));
+    }
+    try {
+        DevicePtr ptr = mapDescriptor(fd, mode, offset, bytes);
+        ::close(fd);
+        return ptr;
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+// The mapping starts on the page holding `offset`, so the address handed
+// out is as far into its first page as `offset` is into the file's.
+DevicePtr GPU::mapDescriptor(int fd, MapMode mode, size_t offset, size_t bytes)
+{
+    if (offset % sizeof(float)) throw std::invalid_argument("mapDescriptor: offset must be a multiple of 4");
+    const size_t page = DeviceMemory::pageSize();
+    const size_t lead = offset % page;
+    std::lock_guard<std::mutex> lock(mtx);
+    const DevicePtr at = mappingRange("mapDescriptor", lead + bytes);
+    try {
+        global_memory.map(at, fd, offset - lead, lead + bytes, mode);
+    } catch (...) {
+        allocator.release(at);
+        throw;
+    }
+    mappedFiles[at + lead] = at;
+    return at + lead;
+}
+
+DevicePtr GPU::mapHost(void* host, size_t bytes, MapMode mode)
+{
+    if (bytes == 0 || bytes % sizeof(float)) throw std::invalid_argument("mapHost: bytes must be a positive multiple of 4");
+    std::lock_guard<std::mutex> lock(mtx);
+    const DevicePtr at = mappingRange("mapHost", bytes);
+    try {
+        global_memory.mapHost(at, host, bytes, mode);
+    } catch (...) {
+        allocator.release(at);
+        throw;
+    }
+    mappedFiles[at] = at;
+    return at;
+}
+
+void GPU::unmap(DevicePtr ptr)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = mappedFiles.find(ptr);
+    if (it == mappedFiles.end()) throw std::invalid_argument("unmap: nothing mapped at " + std::to_string(ptr));
+    global_memory.unmap(it->second);
+    allocator.release(it->second);
+    mappedFiles.erase(it);
+}
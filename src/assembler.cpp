@@ -0,0 +1,374 @@
+#include "assembler.hpp"
+#include "binio.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <sys/stat.h>
+
+static std::runtime_error syntaxError(int line, const std::string& msg)
+{
+    return std::runtime_error("line " + std::to_string(line) + ": " + msg);
+}
+
+static std::string upper(std::string s)
+{
+    for (auto& c : s) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    return s;
+}
+
+static std::vector<std::string> tokenize(std::string line)
+{
+    for (const char* marker : {";", "#", "//"}) {
+        size_t pos = line.find(marker);
+        if (pos != std::string::npos) line.erase(pos);
+    }
+    for (auto& c : line) {
+        if (c == ',') c = ' ';
+    }
+    std::vector<std::string> tokens;
+    std::istringstream in(line);
+    std::string tok;
+    while (in >> tok) tokens.push_back(tok);
+    return tokens;
+}
+
+// Decimal literals only: strtof would also take "inf", "nan" and hex
+// floats, which are valid variable names here.
+static bool parseNumber(const std::string& tok, float& out)
+{
+    size_t i = tok.size() > 1 && (tok[0] == '-' || tok[0] == '+') ? 1 : 0;
+    const size_t digits = i < tok.size() && tok[i] == '.' ? i + 1 : i;
+    if (digits >= tok.size() || !std::isdigit(static_cast<unsigned char>(tok[digits]))) return false;
+    if (tok.find_first_of("xXpP") != std::string::npos) return false;
+    char* end = nullptr;
+    out = std::strtof(tok.c_str(), &end);
+    return end != tok.c_str() && *end == '\0';
+}
+
+// False for anything that is not a whole decimal int, out of range included.
+static bool parseInt(const std::string& tok, int& out)
+{
+    char* end = nullptr;
+    errno = 0;
+    long v = std::strtol(tok.c_str(), &end, 10);
+    if (errno == ERANGE || v < INT_MIN || v > INT_MAX) return false;
+    out = static_cast<int>(v);
+    return end != tok.c_str() && *end == '\0';
+}
+
+static bool parseOpcode(const std::string& name, Opcode& out)
+{
+    for (int i = 0; i <= static_cast<int>(Opcode::XOR); i++) {
+        if (name == opcodeName(static_cast<Opcode>(i))) {
+            out = static_cast<Opcode>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int expectedOperands(Opcode op)
+{
+    switch (op) {
+        case Opcode::ADD: case Opcode::SUB: case Opcode::MUL: case Opcode::DIV:
+        case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+            return 3;
+        case Opcode::NEG: case Opcode::MOV: case Opcode::LD: case Opcode::ST:
+        case Opcode::CMP_LT: case Opcode::LABEL:
+            return 2;
+        case Opcode::JMP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static Instr parseDef(const std::vector<std::string>& tok, int line)
+{
+    if (tok.size() < 5 || tok.size() > 6)
+        throw syntaxError(line, "expected DEF name GLOBAL|SHARED|LOCAL value offset|TIDX [CONST]");
+
+    Variable var{tok[1], 0.0f, 0, false, false, StoreLoc::LOCAL};
+    std::string loc = upper(tok[2]);
+    if (loc == "GLOBAL") var.loc = StoreLoc::GLOBAL;
+    else if (loc == "SHARED") var.loc = StoreLoc::SHARED;
+    else if (loc == "LOCAL") var.loc = StoreLoc::LOCAL;
+    else throw syntaxError(line, "unknown store location " + tok[2]);
+
+    if (!parseNumber(tok[3], var.value))
+        throw syntaxError(line, "bad initial value " + tok[3]);
+    if (upper(tok[4]) == "TIDX") var.threadIDX = true;
+    else if (!parseInt(tok[4], var.offset)) throw syntaxError(line, "bad offset " + tok[4]);
+
+    if (tok.size() == 6) {
+        if (upper(tok[5]) != "CONST") throw syntaxError(line, "unexpected " + tok[5]);
+        var.isConstant = true;
+    }
+    return {Opcode::DEF, {var}};
+}
+
+std::vector<Instr> assemble(const std::string& source)
+{
+    std::vector<Instr> program;
+    std::istringstream in(source);
+    std::string text;
+    int line = 0;
+    while (std::getline(in, text)) {
+        line++;
+        std::vector<std::string> tok = tokenize(text);
+        if (tok.empty()) continue;
+
+        // "NAME:" marks a label at the current position
+        if (tok.size() == 1 && tok[0].size() > 1 && tok[0].back() == ':') {
+            std::string name = tok[0].substr(0, tok[0].size() - 1);
+            program.push_back({Opcode::LABEL, {name, static_cast<int>(program.size())}});
+            continue;
+        }
+
+        // LD.V2 / LD.V4 (and ST) move 2 or 4 consecutive words per lane
+        std::string name = upper(tok[0]);
+        int width = 1;
+        size_t dot = name.find('.');
+        if (dot != std::string::npos) {
+            std::string suffix = name.substr(dot + 1);
+            if (suffix == "V2") width = 2;
+            else if (suffix == "V4") width = 4;
+            else throw syntaxError(line, "unknown suffix ." + suffix);
+            name.erase(dot);
+        }
+        Opcode op;
+        if (!parseOpcode(name, op))
+            throw syntaxError(line, "unknown opcode " + tok[0]);
+        if (width > 1 && op != Opcode::LD && op != Opcode::ST)
+            throw syntaxError(line, std::string(opcodeName(op)) + " has no vector form");
+        if (op == Opcode::DEF) {
+            program.push_back(parseDef(tok, line));
+            continue;
+        }
+
+        int operands = static_cast<int>(tok.size()) - 1;
+        if (operands != expectedOperands(op))
+            throw syntaxError(line, std::string(opcodeName(op)) + " takes " +
+                                    std::to_string(expectedOperands(op)) + " operands");
+
+        Instr instr{op, {}, width};
+        for (size_t i = 1; i < tok.size(); i++) {
+            float value;
+            int pos;
+            if (op == Opcode::LABEL && i == 2) {
+                if (!parseInt(tok[i], pos)) throw syntaxError(line, "label position must be an integer");
+                instr.src.push_back(pos);
+            } else if (parseNumber(tok[i], value)) {
+                instr.src.push_back(value);
+            } else {
+                instr.src.push_back(tok[i]);
+            }
+        }
+        program.push_back(instr);
+    }
+    return program;
+}
+
+std::string readKernelFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) throw std::runtime_error("cannot open kernel " + path);
+    std::ostringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+uint64_t contentHash(const std::string& data)
+{
+    // FNV-1a
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+void putInstr(std::string& out, const DecodedInstr& d)
+{
+    put(out, static_cast<uint8_t>(d.op));
+    put(out, static_cast<uint8_t>(d.numOperands));
+    put(out, d.width);
+    for (int i = 0; i < d.numOperands; i++) {
+        const DecodedOperand& o = d.src[i];
+        put(out, static_cast<uint8_t>(o.kind));
+        put(out, static_cast<uint8_t>(o.tidx));
+        put(out, o.index);
+        put(out, o.constVal);
+        put(out, o.slot);
+        put(out, o.base);
+        put(out, static_cast<uint8_t>(o.baseAddress));
+    }
+}
+
+static bool getInstr(Reader& in, DecodedInstr& d)
+{
+    uint8_t op, numOperands;
+    if (!in.get(op) || !in.get(numOperands) || !in.get(d.width)) return false;
+    if (op > static_cast<uint8_t>(Opcode::XOR) || numOperands > MAX_OPERANDS) return false;
+    d.op = static_cast<Opcode>(op);
+    d.numOperands = numOperands;
+    for (int i = 0; i < d.numOperands; i++) {
+        DecodedOperand& o = d.src[i];
+        uint8_t kind, tidx, baseAddress;
+        if (!in.get(kind) || !in.get(tidx) || !in.get(o.index) || !in.get(o.constVal) || !in.get(o.slot) ||
+            !in.get(o.base) || !in.get(baseAddress) || kind > static_cast<uint8_t>(OpKind::Invalid))
+            return false;
+        o.kind = static_cast<OpKind>(kind);
+        o.tidx = tidx != 0;
+        o.baseAddress = baseAddress != 0;
+    }
+    return true;
+}
+
+// Whether every index in a loaded instruction points at something the
+// program has, so a corrupt file whose hash still matches cannot send
+// fetch, DEF or formatTrace outside the tables. Register numbers are
+// checked against the warp at run time, as for assembled code.
+static bool validInstr(const DecodedInstr& d, const Program& program)
+{
+    if (d.width != 1 && d.width != 2 && d.width != 4) return false;
+    for (int i = 0; i < d.numOperands; i++) {
+        const DecodedOperand& o = d.src[i];
+        const size_t table = o.kind == OpKind::Symbol ? program.symbols.size() : program.vars.size();
+        if (o.slot < -1 || (o.slot >= 0 && static_cast<size_t>(o.slot) >= table)) return false;
+        if (o.base < -1) return false;
+        switch (o.kind) {
+            case OpKind::Symbol:
+                if (o.slot < 0) return false;
+                break;
+            case OpKind::Register:
+                if (!o.tidx && o.index < 0) return false;
+                break;
+            case OpKind::Special:
+                if (o.index < 0 || o.index >= NUM_SPECIAL_REGS) return false;
+                break;
+            case OpKind::Param:
+            case OpKind::Address:
+                if (o.index < 0) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    // an explicit label position becomes a JMP target; code.size() runs off the end
+    if (d.op == Opcode::LABEL && d.numOperands > 1 && d.src[1].kind == OpKind::Constant &&
+        (d.src[1].index < 0 || static_cast<size_t>(d.src[1].index) > program.code.size()))
+        return false;
+    return d.op != Opcode::DEF || (d.numOperands > 0 && d.src[0].slot >= 0);
+}
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t numInstrs;
+    uint32_t numVars;
+    uint64_t key;
+    uint32_t numSymbols;
+    uint32_t reserved;
+};
+
+bool saveProgram(const Program& program, uint64_t key, const std::string& path)
+{
+    CacheHeader header{{'G', 'P', 'U', 'K'}, PROGRAM_FORMAT_VERSION,
+                       static_cast<uint32_t>(program.code.size()),
+                       static_cast<uint32_t>(program.vars.size()), key,
+                       static_cast<uint32_t>(program.symbols.size()), 0};
+    std::string out;
+    put(out, header);
+    for (const auto& d : program.code) {
+        putInstr(out, d);
+    }
+    for (const auto& v : program.vars) {
+        put(out, v.value);
+        put(out, static_cast<int32_t>(v.offset));
+        put(out, static_cast<uint8_t>(v.isConstant));
+        put(out, static_cast<uint8_t>(v.threadIDX));
+        put(out, static_cast<uint8_t>(v.loc));
+        putString(out, v.name);
+    }
+    for (const auto& s : program.symbols) {
+        putString(out, s);
+    }
+
+    // write then rename so concurrent runs never map a half-written file
+    return writeFileAtomic(path, out);
+}
+
+bool loadProgram(const std::string& path, uint64_t key, Program& program)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(CacheHeader)) return false;
+
+    Reader in{file.data(), file.data() + file.size()};
+    CacheHeader header;
+    bool ok = in.get(header) && std::memcmp(header.magic, "GPUK", 4) == 0 &&
+              header.version == PROGRAM_FORMAT_VERSION && header.key == key;
+    // every record takes at least 3 bytes, so the counts cannot exceed the file
+    ok = ok && static_cast<size_t>(in.end - in.p) / 3 >=
+                   size_t(header.numInstrs) + header.numVars + header.numSymbols;
+
+    Program loaded;
+    if (ok) {
+        loaded.code.resize(header.numInstrs);
+        for (auto& d : loaded.code) {
+            ok = ok && getInstr(in, d);
+        }
+        loaded.vars.resize(header.numVars);
+        for (auto& v : loaded.vars) {
+            int32_t offset = 0;
+            uint8_t isConstant = 0, threadIDX = 0, loc = 0;
+            ok = ok && in.get(v.value) && in.get(offset) && in.get(isConstant) &&
+                 in.get(threadIDX) && in.get(loc) && in.getString(v.name);
+            v.offset = offset;
+            v.isConstant = isConstant;
+            v.threadIDX = threadIDX;
+            v.loc = static_cast<StoreLoc>(loc);
+            ok = ok && loc <= static_cast<uint8_t>(StoreLoc::LOCAL);
+        }
+        loaded.symbols.resize(header.numSymbols);
+        for (auto& s : loaded.symbols) {
+            ok = ok && in.getString(s);
+        }
+        for (const auto& d : loaded.code) {
+            ok = ok && validInstr(d, loaded);
+        }
+    }
+    if (ok) {
+        // JMP targets are already in the code; this only rebuilds the tables
+        resolveLabels(loaded);
+        computeReconvergence(loaded);
+        program = std::move(loaded);
+    }
+    return ok;
+}
+
+Program loadKernel(const std::string& path, const std::string& cacheDir)
+{
+    std::string source = readKernelFile(path);
+    if (cacheDir.empty()) return compileProgram(assemble(source));
+
+    uint64_t key = contentHash(source) ^ PROGRAM_FORMAT_VERSION;
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.gpk", static_cast<unsigned long long>(key));
+    std::string cached = cacheDir + "/" + name;
+
+    Program program;
+    if (loadProgram(cached, key, program)) return program;
+
+    program = compileProgram(assemble(source));
+    ::mkdir(cacheDir.c_str(), 0755);
+    saveProgram(program, key, cached);
+    return program;
+}
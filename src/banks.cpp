@@ -0,0 +1,19 @@
+#include "banks.hpp"
+#include "config.hpp"
+#include <algorithm>
+
+BankAccess bankAccess(const int* words, uint32_t mask, int lanes, int width)
+{
+    int touched[MAX_WARP_SIZE * 4];
+    int n = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (!((mask >> lane) & 1u)) continue;
+        for (int w = 0; w < width; w++) touched[n++] = words[lane] + w;
+    }
+    std::sort(touched, touched + n);
+    BankAccess access;
+    access.words = static_cast<int>(std::unique(touched, touched + n) - touched);
+    int perBank[SHARED_BANKS] = {};
+    for (int i = 0; i < access.words; i++) access.passes = std::max(access.passes, ++perBank[touched[i] % SHARED_BANKS]);
+    return access;
+}
@@ -0,0 +1,50 @@
+#include "binio.hpp"
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile()
+{
+    if (map) ::munmap(map, length);
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* m = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) return false;
+    if (map) ::munmap(map, length);
+    map = m;
+    length = size;
+    return true;
+}
+
+bool writeFileAtomic(const std::string& path, const std::string& data)
+{
+    std::string tmp = path + ".tmp" + std::to_string(::getpid());
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = ::ftruncate(fd, static_cast<off_t>(data.size())) == 0;
+    if (ok && !data.empty()) {
+        void* m = ::mmap(nullptr, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = m != MAP_FAILED;
+        if (ok) {
+            std::memcpy(m, data.data(), data.size());
+            ::munmap(m, data.size());
+        }
+    }
+    ::close(fd);
+    if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+}
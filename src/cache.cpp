@@ -0,0 +1,90 @@
+#include "cache.hpp"
+#include <numeric>
+#include <stdexcept>
+
+Cache::Cache(const CacheConfig& config) : cfg(config)
+{
+    if (cfg.line_bytes < 1 || cfg.line_bytes % 32 || cfg.ways < 1 || cfg.ways > 255 ||
+        cfg.size_bytes < static_cast<size_t>(cfg.line_bytes) * cfg.ways)
+        throw std::invalid_argument("CacheConfig: lines must be a multiple of 32 bytes, 1 to 255 ways, "
+                                    "and the size at least one set");
+    sets = cfg.size_bytes / (static_cast<size_t>(cfg.line_bytes) * cfg.ways);
+    clear();
+}
+
+void Cache::clear()
+{
+    lines.assign(sets * cfg.ways, 0);
+    order.resize(lines.size());
+    // every set starts as a permutation, so ranks stay distinct
+    for (uint64_t s = 0; s < sets; s++) std::iota(order.begin() + s * cfg.ways, order.begin() + (s + 1) * cfg.ways, 0);
+    random = 2463534242u;
+}
+
+// Moves `way` to the front, ageing the lines that were ahead of it.
+void Cache::touch(uint8_t* rank, int way)
+{
+    const uint8_t r = rank[way];
+    for (int w = 0; w < cfg.ways; w++) {
+        if (rank[w] < r) rank[w]++;
+    }
+    rank[way] = 0;
+}
+
+Cache::Access Cache::access(uint64_t address, bool write)
+{
+    const uint64_t line = address / cfg.line_bytes;
+    const uint64_t set = line % sets;
+    const uint32_t tag = static_cast<uint32_t>(line / sets);
+    uint32_t* way = &lines[set * cfg.ways];
+    uint8_t* rank = &order[set * cfg.ways];
+    const bool writeBack = cfg.write == WritePolicy::WriteBack;
+
+    Access result;
+    for (int w = 0; w < cfg.ways; w++) {
+        if ((way[w] & VALID) && way[w] >> TAG_SHIFT == tag) {
+            if (cfg.replacement == ReplacementPolicy::LRU) touch(rank, w);
+            if (write && writeBack) way[w] |= DIRTY;
+            result.hit = true;
+            return result;
+        }
+    }
+    if (write && !writeBack) return result;
+
+    int victim = -1;
+    for (int w = 0; w < cfg.ways && victim < 0; w++) {
+        if (!(way[w] & VALID)) victim = w;
+    }
+    if (victim < 0 && cfg.replacement == ReplacementPolicy::Random) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        victim = static_cast<int>(random % cfg.ways);
+    }
+    if (victim < 0) {
+        victim = 0;
+        for (int w = 1; w < cfg.ways; w++) {
+            if (rank[w] > rank[victim]) victim = w;
+        }
+    }
+    if (way[victim] & VALID) {
+        result.evicted = true;
+        result.writeback = way[victim] & DIRTY;
+        result.victim = (static_cast<uint64_t>(way[victim] >> TAG_SHIFT) * sets + set) * cfg.line_bytes;
+    }
+    way[victim] = tag << TAG_SHIFT | (write ? DIRTY : 0) | VALID;
+    touch(rank, victim);
+    return result;
+}
+
+void Cache::save(std::string& out) const
+{
+    putArray(out, lines.data(), lines.size());
+    putArray(out, order.data(), order.size());
+    put(out, random);
+}
+
+bool Cache::load(Reader& in)
+{
+    return in.getArray(lines.data(), lines.size()) && in.getArray(order.data(), order.size()) && in.get(random);
+}
@@ -0,0 +1,401 @@
+#include "gpu.hpp"
+#include "binio.hpp"
+#include "assembler.hpp"
+#include <stdexcept>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<WarpCounters>::value, "WarpCounters is checkpointed as raw bytes");
+static_assert(std::is_trivially_copyable<SmCounters>::value, "SmCounters is checkpointed as raw bytes");
+static_assert(std::is_trivially_copyable<SimtEntry>::value, "SimtEntry is checkpointed as raw bytes");
+static_assert(std::is_trivially_copyable<GlobalStore>::value, "GlobalStore is checkpointed as raw bytes");
+static_assert(std::is_trivially_copyable<Dim3>::value, "Dim3 is checkpointed as raw bytes");
+
+constexpr uint32_t CHECKPOINT_VERSION = 8;
+
+// A checkpoint only restores onto a GPU with the same geometry running
+// the same program; everything else is checked against this header.
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t size; // whole blob, header included
+    uint64_t program;
+    int32_t numSms;
+    int32_t warpsPerSm;
+    int32_t warpSize;
+    int32_t registers;
+    int32_t addressRegisters;
+    uint64_t globalWords;
+    uint64_t sharedWords; // per SM
+    int32_t blockSlots;
+    uint64_t numVars;
+};
+
+// Hash of the decoded code, field by field so struct padding is ignored.
+static uint64_t programFingerprint(const Program& program)
+{
+    std::string bytes;
+    for (const auto& d : program.code) {
+        putInstr(bytes, d);
+    }
+    return contentHash(bytes);
+}
+
+// A flag for whether there is a cache, then its tags.
+static void saveCache(std::string& out, const Cache* cache)
+{
+    put(out, static_cast<uint8_t>(cache != nullptr));
+    if (cache) cache->save(out);
+}
+
+static bool loadCache(Reader& in, Cache* cache)
+{
+    uint8_t present;
+    return in.get(present) && present == (cache != nullptr) && (!cache || cache->load(in));
+}
+
+static CheckpointHeader headerFor(const GPU& gpu)
+{
+    CheckpointHeader h{{'G', 'P', 'U', 'C'}, CHECKPOINT_VERSION, 0, programFingerprint(gpu.program),
+                       gpu.config.num_sms, gpu.config.warps_per_sm, gpu.config.warp_size,
+                       gpu.config.registers_per_thread, gpu.config.address_registers, gpu.global_memory.size(),
+                       gpu.config.shared_mem_bytes / sizeof(float),
+                       gpu.sms.empty() ? 0 : static_cast<int32_t>(gpu.sms[0].blocks.size()),
+                       gpu.program.vars.size()};
+    return h;
+}
+
+std::string GPU::checkpoint()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    // stream work holds host pointers and programs a blob cannot name
+    if (!streamsIdle()) throw std::logic_error("checkpoint: streams have work queued");
+    // mapped files are host state; a blob would copy them whole
+    if (global_memory.hasMappings()) throw std::logic_error("checkpoint: host files or buffers are mapped into global memory");
+    // warps last used by a stream kernel are free; their variable slots
+    // go back to the GPU's own program so every warp saves the same size
+    for (auto& sm : sms) {
+        for (auto& warp : sm.warps) {
+            if (warp.kernel == 0) continue;
+            warp.bindVars(program.vars.size());
+            warp.kernel = 0;
+        }
+    }
+    std::string out;
+    CheckpointHeader header = headerFor(*this);
+    put(out, header);
+
+    put(out, static_cast<int64_t>(cycle_count));
+    put(out, static_cast<uint8_t>(appliedScheduler));
+    putArray(out, global_memory.data(), global_memory.size());
+    allocator.save(out);
+    saveCache(out, l2.get());
+    put(out, kernel.grid);
+    put(out, kernel.block);
+    put(out, static_cast<uint64_t>(kernel.params.size()));
+    putArray(out, kernel.params.data(), kernel.params.size());
+    put(out, static_cast<uint64_t>(kernel.sharedWords));
+    put(out, static_cast<int32_t>(kernel.nextBlock));
+    put(out, static_cast<int32_t>(nextSm));
+    for (const auto& sm : sms) {
+        put(out, static_cast<uint64_t>(sm.shared_pc));
+        put(out, sm.counters);
+        sm.scheduler->save(out);
+        saveCache(out, sm.l1.get());
+        put(out, static_cast<uint64_t>(sm.bankConflictsAt.size()));
+        for (const auto& [at, passes] : sm.bankConflictsAt) {
+            put(out, static_cast<int32_t>(at.first));
+            put(out, at.second);
+            put(out, passes);
+        }
+        put(out, static_cast<uint64_t>(sm.pendingStores.size()));
+        putArray(out, sm.pendingStores.data(), sm.pendingStores.size());
+        put(out, static_cast<uint64_t>(sm.sharedFree));
+        for (const auto& block : sm.blocks) {
+            put(out, static_cast<int32_t>(block.id));
+            put(out, block.idx);
+            put(out, static_cast<uint64_t>(block.memory.size()));
+            putArray(out, block.memory.data(), block.memory.size());
+        }
+        for (const auto& warp : sm.warps) {
+            put(out, static_cast<int32_t>(warp.block));
+            put(out, static_cast<int32_t>(warp.blockThread));
+            putArray(out, warp.registers.data(), warp.registers.size());
+            putArray(out, warp.addresses.data(), warp.addresses.size());
+            putArray(out, warp.varOffsets.data(), warp.varOffsets.size());
+            put(out, static_cast<uint32_t>(warp.simtStack.size()));
+            putArray(out, warp.simtStack.data(), warp.simtStack.size());
+            putArray(out, warp.regReady.data(), warp.regReady.size());
+            put(out, warp.predReady);
+            putArray(out, warp.memReady, 2);
+            put(out, warp.nextIssue);
+            put(out, warp.counters);
+            for (const auto& t : warp.threads) {
+                put(out, static_cast<int32_t>(t->id_));
+                put(out, static_cast<uint64_t>(t->pc));
+                put(out, static_cast<uint8_t>(t->active));
+                put(out, static_cast<int32_t>(t->predicateReg));
+            }
+        }
+    }
+
+    header.size = out.size();
+    std::memcpy(&out[0], &header, sizeof(header));
+    return out;
+}
+
+bool GPU::restore(const std::string& blob)
+{
+    return restore(blob.data(), blob.size());
+}
+
+// What restore() reads, staged so that a blob that turns out to be
+// truncated or corrupt part way leaves the GPU untouched. Global memory,
+// the bulk of a blob, is not copied twice: the staged state points into
+// the blob and is copied out on commit.
+namespace {
+
+struct StagedThread {
+    int32_t id;
+    uint64_t pc;
+    uint8_t active;
+    int32_t pred;
+};
+
+struct StagedWarp {
+    int32_t block, blockThread;
+    std::vector<float> registers;
+    std::vector<int64_t> addresses;
+    std::vector<int> varOffsets;
+    std::vector<SimtEntry> simtStack;
+    std::vector<uint64_t> regReady;
+    uint64_t predReady, memReady[2], nextIssue;
+    WarpCounters counters;
+    std::vector<StagedThread> threads;
+};
+
+struct StagedBlock {
+    int32_t id;
+    Dim3 idx;
+    std::vector<float> memory;
+};
+
+struct StagedSm {
+    uint64_t pc;
+    SmCounters counters;
+    std::unique_ptr<WarpScheduler> scheduler;
+    std::unique_ptr<Cache> l1;
+    std::map<std::pair<int, uint32_t>, uint64_t> bankConflictsAt;
+    std::vector<GlobalStore> pendingStores;
+    uint64_t sharedFree;
+    std::vector<StagedBlock> blocks;
+    std::vector<StagedWarp> warps;
+};
+
+// Reads `count` elements into `v`, refusing counts the blob cannot hold.
+template <typename T>
+bool getVector(Reader& in, std::vector<T>& v, uint64_t count)
+{
+    if (count > static_cast<uint64_t>(in.end - in.p) / sizeof(T)) return false;
+    v.resize(count);
+    return in.getArray(v.data(), v.size());
+}
+
+// Whether a restored SIMT stack only holds pcs the program has. The top
+// entry is the next instruction to issue; entries below it may wait at
+// the exit (code.size()), and the bottom one never reconverges.
+bool validSimtStack(const std::vector<SimtEntry>& stack, size_t codeSize)
+{
+    for (const auto& entry : stack) {
+        if (entry.pc > codeSize || (entry.rpc > codeSize && entry.rpc != NO_RECONVERGE)) return false;
+    }
+    return stack.empty() || stack.back().pc < codeSize;
+}
+
+} // namespace
+
+bool GPU::restore(const char* data, size_t size)
+{
+    Reader in{data, data + size};
+    CheckpointHeader header;
+    if (!in.get(header)) return false;
+    CheckpointHeader expect = headerFor(*this);
+    if (std::memcmp(header.magic, expect.magic, 4) != 0 || header.version != CHECKPOINT_VERSION ||
+        header.size != size || header.program != expect.program || header.numSms != expect.numSms ||
+        header.warpsPerSm != expect.warpsPerSm || header.warpSize != expect.warpSize ||
+        header.registers != expect.registers || header.addressRegisters != expect.addressRegisters ||
+        header.globalWords != expect.globalWords ||
+        header.sharedWords != expect.sharedWords || header.blockSlots != expect.blockSlots ||
+        header.numVars != expect.numVars)
+        return false;
+
+    stop();
+    std::lock_guard<std::mutex> lock(mtx);
+    // neither mapped files nor queued stream work can be put back afterwards
+    if (global_memory.hasMappings() || !streamsIdle()) return false;
+
+    int64_t cycle;
+    uint8_t policy;
+    const size_t globalBytes = global_memory.size() * sizeof(float);
+    bool ok = in.get(cycle) && in.get(policy) && policy <= static_cast<uint8_t>(SchedulerPolicy::TwoLevel) &&
+              static_cast<size_t>(in.end - in.p) >= globalBytes;
+    if (!ok) return false;
+    const char* globalWords = in.p;
+    in.p += globalBytes;
+
+    DeviceAllocator stagedAllocator = allocator;
+    std::unique_ptr<Cache> stagedL2 = l2 ? std::make_unique<Cache>(*l2) : nullptr;
+    ok = stagedAllocator.load(in) && loadCache(in, stagedL2.get());
+
+    KernelLaunch launch;
+    uint64_t numParams = 0, sharedWords = 0;
+    int32_t nextBlock = 0, sm0 = 0;
+    ok = ok && in.get(launch.grid) && in.get(launch.block) && in.get(numParams) &&
+         getVector(in, launch.params, numParams) && in.get(sharedWords) && in.get(nextBlock) && in.get(sm0) &&
+         sharedWords <= config.shared_mem_bytes / sizeof(float) && sm0 >= 0 &&
+         sm0 < static_cast<int32_t>(sms.size());
+    if (ok) {
+        // only a shape launch() would have taken
+        try {
+            checkLaunch(launch.grid, launch.block, static_cast<size_t>(sharedWords));
+        } catch (const std::invalid_argument&) {
+            ok = false;
+        }
+        ok = ok && nextBlock >= 0 && nextBlock <= launch.numBlocks();
+    }
+
+    const size_t numVars = program.vars.size();
+    const size_t codeSize = program.code.size();
+    std::vector<StagedSm> staged(sms.size());
+    for (size_t s = 0; ok && s < sms.size(); s++) {
+        const SM& sm = sms[s];
+        StagedSm& st = staged[s];
+        uint64_t conflicted = 0, stores = 0;
+        st.scheduler = makeScheduler(static_cast<SchedulerPolicy>(policy), config.warps_per_sm, config.two_level_active);
+        if (sm.l1) st.l1 = std::make_unique<Cache>(*sm.l1);
+        ok = in.get(st.pc) && st.pc <= codeSize && in.get(st.counters) && st.scheduler->load(in) &&
+             loadCache(in, st.l1.get()) && in.get(conflicted);
+        for (uint64_t i = 0; ok && i < conflicted; i++) {
+            int32_t handle = 0;
+            uint32_t at = 0;
+            uint64_t passes = 0;
+            ok = in.get(handle) && in.get(at) && in.get(passes);
+            st.bankConflictsAt[{handle, at}] = passes;
+        }
+        ok = ok && in.get(stores) && getVector(in, st.pendingStores, stores) && in.get(st.sharedFree);
+        for (const auto& store : st.pendingStores) {
+            ok = ok && store.index >= 0 && static_cast<size_t>(store.index) < global_memory.size();
+        }
+
+        st.blocks.resize(sm.blocks.size());
+        for (auto& block : st.blocks) {
+            uint64_t words;
+            ok = ok && in.get(block.id) && in.get(block.idx) && in.get(words) && getVector(in, block.memory, words);
+        }
+        st.warps.resize(sm.warps.size());
+        for (size_t w = 0; ok && w < sm.warps.size(); w++) {
+            const Warp& live = sm.warps[w];
+            StagedWarp& warp = st.warps[w];
+            uint32_t depth;
+            ok = in.get(warp.block) && in.get(warp.blockThread) && warp.block >= -1 &&
+                 warp.block < static_cast<int32_t>(sm.blocks.size()) &&
+                 getVector(in, warp.registers, live.registers.size()) &&
+                 getVector(in, warp.addresses, live.addresses.size()) &&
+                 getVector(in, warp.varOffsets, numVars * live.width) && in.get(depth) &&
+                 getVector(in, warp.simtStack, depth) && getVector(in, warp.regReady, live.regReady.size()) &&
+                 in.get(warp.predReady) && in.getArray(warp.memReady, 2) && in.get(warp.nextIssue) &&
+                 in.get(warp.counters);
+            ok = ok && validSimtStack(warp.simtStack, codeSize);
+            for (size_t v = 0; ok && v < warp.varOffsets.size(); v++) {
+                const int offset = warp.varOffsets[v];
+                const StoreLoc loc = program.vars[v / live.width].loc;
+                const size_t words = loc == StoreLoc::LOCAL    ? static_cast<size_t>(live.num_registers)
+                                     : loc == StoreLoc::GLOBAL ? global_memory.size()
+                                     : warp.block >= 0         ? st.blocks[warp.block].memory.size()
+                                                               : 0;
+                ok = offset == -1 || (offset >= 0 && static_cast<size_t>(offset) < words);
+            }
+            warp.threads.resize(live.threads.size());
+            for (auto& t : warp.threads) {
+                ok = ok && in.get(t.id) && in.get(t.pc) && t.pc <= codeSize && in.get(t.active) && in.get(t.pred);
+            }
+        }
+    }
+    // the size was checked up front, so this only fails on a corrupt blob
+    if (!ok || in.p != in.end) return false;
+
+    // Everything is read; nothing below can fail.
+    cycle_count = cycle;
+    schedulerPolicy = static_cast<SchedulerPolicy>(policy);
+    appliedScheduler = schedulerPolicy;
+    std::memcpy(global_memory.data(), globalWords, globalBytes);
+    allocator = std::move(stagedAllocator);
+    if (l2) *l2 = std::move(*stagedL2);
+
+    launch.sharedWords = static_cast<size_t>(sharedWords);
+    launch.warpsPerBlock = (launch.block.count() + config.warp_size - 1) / config.warp_size;
+    launch.nextBlock = nextBlock;
+    launch.program = &program;
+    launch.threaded = threaded.get();
+    kernel = std::move(launch);
+    nextSm = sm0;
+
+    for (size_t s = 0; s < sms.size(); s++) {
+        SM& sm = sms[s];
+        StagedSm& st = staged[s];
+        sm.shared_pc = static_cast<size_t>(st.pc);
+        sm.counters = st.counters;
+        sm.scheduler = std::move(st.scheduler);
+        if (sm.l1) *sm.l1 = std::move(*st.l1);
+        sm.bankConflictsAt = std::move(st.bankConflictsAt);
+        sm.pendingStores = std::move(st.pendingStores);
+        sm.sharedFree = static_cast<size_t>(st.sharedFree);
+        sm.warpRetired = false;
+        sm.trace.clear();
+        sm.l2Queue.clear();
+        for (size_t b = 0; b < sm.blocks.size(); b++) {
+            Block& block = sm.blocks[b];
+            block.id = st.blocks[b].id;
+            block.idx = st.blocks[b].idx;
+            block.memory = std::move(st.blocks[b].memory);
+            block.launch = &kernel;
+            if (block.id >= 0) kernel.residentBlocks++;
+        }
+        for (size_t w = 0; w < sm.warps.size(); w++) {
+            Warp& warp = sm.warps[w];
+            StagedWarp& from = st.warps[w];
+            warp.kernel = 0;
+            warp.block = from.block;
+            warp.blockThread = from.blockThread;
+            warp.registers = std::move(from.registers);
+            warp.addresses = std::move(from.addresses);
+            warp.varOffsets = std::move(from.varOffsets);
+            warp.simtStack = std::move(from.simtStack);
+            warp.regReady = std::move(from.regReady);
+            warp.predReady = from.predReady;
+            warp.memReady[0] = from.memReady[0];
+            warp.memReady[1] = from.memReady[1];
+            warp.nextIssue = from.nextIssue;
+            warp.counters = from.counters;
+            for (size_t t = 0; t < warp.threads.size(); t++) {
+                Thread& thread = *warp.threads[t];
+                thread.id_ = from.threads[t].id;
+                thread.pc = static_cast<size_t>(from.threads[t].pc);
+                thread.active = from.threads[t].active;
+                thread.predicateReg = from.threads[t].pred;
+            }
+        }
+    }
+    finished = isFinished();
+    return true;
+}
+
+bool GPU::checkpointToFile(const std::string& path)
+{
+    return writeFileAtomic(path, checkpoint());
+}
+
+bool GPU::restoreFromFile(const std::string& path)
+{
+    MappedFile file;
+    return file.open(path) && restore(file.data(), file.size());
+}
@@ -0,0 +1,26 @@
+#include "coalescer.hpp"
+
+// Accesses are aligned to their width of at most 16 bytes (see
+// laneAddresses), so each one falls inside a single sector.
+void coalesce(const int* words, uint32_t mask, int lanes, int width, CoalescedRequest& out)
+{
+    out.transactions = 0;
+    out.sectors = 0;
+    out.bytes = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (!((mask >> lane) & 1u)) continue;
+        const uint64_t at = static_cast<uint64_t>(words[lane]) * sizeof(float);
+        const uint64_t segment = at / SEGMENT_BYTES * SEGMENT_BYTES;
+        const uint8_t sector = static_cast<uint8_t>(1u << ((at - segment) / SECTOR_BYTES));
+        out.bytes += width * static_cast<int>(sizeof(float));
+        int t = 0;
+        while (t < out.transactions && out.segment[t] != segment) t++;
+        if (t == out.transactions) {
+            out.segment[t] = segment;
+            out.sectorMask[t] = 0;
+            out.transactions++;
+        }
+        if (!(out.sectorMask[t] & sector)) out.sectors++;
+        out.sectorMask[t] |= sector;
+    }
+}
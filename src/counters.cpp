@@ -0,0 +1,237 @@
+#include "counters.hpp"
+#include "gpu.hpp"
+#include <cctype>
+#include <limits>
+#include <ostream>
+#include <string>
+
+static int popcount(uint32_t mask) { return __builtin_popcount(mask); }
+
+static void countAccess(uint64_t* counts, const DecodedOperand& o, int lanes)
+{
+    if (o.kind == OpKind::Global) counts[static_cast<int>(MemSpace::Global)] += lanes;
+    else if (o.kind == OpKind::Shared) counts[static_cast<int>(MemSpace::Shared)] += lanes;
+}
+
+void WarpCounters::count(const DecodedInstr& instr, uint32_t mask, uint32_t taken)
+{
+    const int lanes = popcount(mask);
+    issued++;
+    opcodes[static_cast<int>(instr.op)]++;
+    activeLanes += lanes;
+
+    // ST writes its first operand even though it is not a destination
+    // register in the usual sense
+    const bool writesFirst = writesDestination(instr.op) || instr.op == Opcode::ST;
+    for (int i = 0; i < instr.numOperands; i++) {
+        // vector LD/ST move `width` words per lane
+        countAccess(i == 0 && writesFirst ? memWrites : memReads, instr.src[i], lanes * instr.width);
+    }
+    if (instr.op == Opcode::JMP) {
+        branches++;
+        if (taken && (taken & mask) != mask) divergentBranches++;
+    }
+}
+
+void WarpCounters::countGlobal(const CoalescedRequest& request)
+{
+    globalRequests++;
+    globalTransactions += request.transactions;
+    globalSectors += request.sectors;
+    globalBytes += request.bytes;
+}
+
+WarpCounters& WarpCounters::operator+=(const WarpCounters& other)
+{
+    issued += other.issued;
+    for (size_t i = 0; i < NUM_OPCODES; i++) opcodes[i] += other.opcodes[i];
+    activeLanes += other.activeLanes;
+    for (int i = 0; i < NUM_STALL_REASONS; i++) stalls[i] += other.stalls[i];
+    for (int i = 0; i < NUM_MEM_SPACES; i++) {
+        memReads[i] += other.memReads[i];
+        memWrites[i] += other.memWrites[i];
+    }
+    branches += other.branches;
+    divergentBranches += other.divergentBranches;
+    globalRequests += other.globalRequests;
+    globalTransactions += other.globalTransactions;
+    globalSectors += other.globalSectors;
+    globalBytes += other.globalBytes;
+    for (int l = 0; l < NUM_CACHE_LEVELS; l++) {
+        for (int e = 0; e < NUM_CACHE_EVENTS; e++) cache[l][e] += other.cache[l][e];
+    }
+    sharedRequests += other.sharedRequests;
+    bankConflicts += other.bankConflicts;
+    return *this;
+}
+
+WarpCounters& WarpCounters::operator-=(const WarpCounters& other)
+{
+    issued -= other.issued;
+    for (size_t i = 0; i < NUM_OPCODES; i++) opcodes[i] -= other.opcodes[i];
+    activeLanes -= other.activeLanes;
+    for (int i = 0; i < NUM_STALL_REASONS; i++) stalls[i] -= other.stalls[i];
+    for (int i = 0; i < NUM_MEM_SPACES; i++) {
+        memReads[i] -= other.memReads[i];
+        memWrites[i] -= other.memWrites[i];
+    }
+    branches -= other.branches;
+    divergentBranches -= other.divergentBranches;
+    globalRequests -= other.globalRequests;
+    globalTransactions -= other.globalTransactions;
+    globalSectors -= other.globalSectors;
+    globalBytes -= other.globalBytes;
+    for (int l = 0; l < NUM_CACHE_LEVELS; l++) {
+        for (int e = 0; e < NUM_CACHE_EVENTS; e++) cache[l][e] -= other.cache[l][e];
+    }
+    sharedRequests -= other.sharedRequests;
+    bankConflicts -= other.bankConflicts;
+    return *this;
+}
+
+const char* stallReasonName(StallReason reason)
+{
+    switch (reason) {
+        case StallReason::Dependency: return "dependency";
+        case StallReason::Pipeline: return "pipeline";
+        case StallReason::NotSelected: return "not_selected";
+    }
+    return "?";
+}
+
+const char* cacheEventName(CacheEvent event)
+{
+    switch (event) {
+        case CacheEvent::ReadHit: return "read_hits";
+        case CacheEvent::ReadMiss: return "read_misses";
+        case CacheEvent::WriteHit: return "write_hits";
+        case CacheEvent::WriteMiss: return "write_misses";
+        case CacheEvent::Eviction: return "evictions";
+        case CacheEvent::Writeback: return "writebacks";
+    }
+    return "?";
+}
+
+static std::string lower(const char* s)
+{
+    std::string out(s);
+    for (auto& c : out) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+
+static double ratio(uint64_t a, uint64_t b) { return b ? static_cast<double>(a) / b : 0.0; }
+
+// Ratios are written with enough digits to read back the same double.
+class RatioPrecision {
+public:
+    explicit RatioPrecision(std::ostream& out)
+        : out(out), saved(out.precision(std::numeric_limits<double>::max_digits10)) {}
+    ~RatioPrecision() { out.precision(saved); }
+
+private:
+    std::ostream& out;
+    std::streamsize saved;
+};
+
+// Flattened name/value pairs shared by the JSON and CSV writers, so both
+// always carry the same columns. Counts are passed as uint64_t so they are
+// written exactly; only the derived ratios are doubles.
+template <typename F>
+static void forEachField(const WarpCounters& c, uint64_t cycles, int warpSize, F field)
+{
+    field("issued", c.issued);
+    field("ipc", ratio(c.issued, cycles));
+    field("lane_utilization", ratio(c.activeLanes, c.issued * static_cast<uint64_t>(warpSize)));
+    for (size_t op = 0; op < NUM_OPCODES; op++) {
+        field("op_" + lower(opcodeName(static_cast<Opcode>(op))), c.opcodes[op]);
+    }
+    for (int r = 0; r < NUM_STALL_REASONS; r++) {
+        field(std::string("stall_") + stallReasonName(static_cast<StallReason>(r)), c.stalls[r]);
+    }
+    field("global_reads", c.memReads[static_cast<int>(MemSpace::Global)]);
+    field("global_writes", c.memWrites[static_cast<int>(MemSpace::Global)]);
+    field("shared_reads", c.memReads[static_cast<int>(MemSpace::Shared)]);
+    field("shared_writes", c.memWrites[static_cast<int>(MemSpace::Shared)]);
+    field("global_requests", c.globalRequests);
+    field("global_transactions", c.globalTransactions);
+    field("global_sectors", c.globalSectors);
+    field("transactions_per_request", ratio(c.globalTransactions, c.globalRequests));
+    // share of the bytes moved that some lane asked for; 1 when fully coalesced
+    field("global_efficiency", ratio(c.globalBytes, c.globalSectors * SECTOR_BYTES));
+    field("shared_requests", c.sharedRequests);
+    field("bank_conflicts", c.bankConflicts);
+    field("conflicts_per_shared_request", ratio(c.bankConflicts, c.sharedRequests));
+    for (int l = 0; l < NUM_CACHE_LEVELS; l++) {
+        const std::string level = "l" + std::to_string(l + 1) + "_";
+        const uint64_t* e = c.cache[l];
+        for (int i = 0; i < NUM_CACHE_EVENTS; i++) {
+            field(level + cacheEventName(static_cast<CacheEvent>(i)), e[i]);
+        }
+        const uint64_t hits = e[static_cast<int>(CacheEvent::ReadHit)] + e[static_cast<int>(CacheEvent::WriteHit)];
+        const uint64_t misses = e[static_cast<int>(CacheEvent::ReadMiss)] + e[static_cast<int>(CacheEvent::WriteMiss)];
+        field(level + "hit_rate", ratio(hits, hits + misses));
+    }
+    field("branches", c.branches);
+    field("divergent_branches", c.divergentBranches);
+}
+
+static void jsonFields(std::ostream& out, const WarpCounters& c, uint64_t cycles, int warpSize)
+{
+    forEachField(c, cycles, warpSize, [&](const std::string& name, auto value) {
+        out << ", \"" << name << "\": " << value;
+    });
+}
+
+void writeCountersJson(std::ostream& out, const GPU& gpu)
+{
+    const uint64_t cycles = static_cast<uint64_t>(gpu.get_cycle());
+    const int warpSize = gpu.config.warp_size;
+    RatioPrecision precision(out);
+    out << "{\n  \"cycles\": " << cycles << ",\n  \"sms\": [\n";
+    for (size_t s = 0; s < gpu.sms.size(); s++) {
+        const SM& sm = gpu.sms[s];
+        WarpCounters smTotal;
+        for (const auto& warp : sm.warps) smTotal += warp.counters;
+
+        out << "    {\"id\": " << sm.id << ", \"active_cycles\": " << sm.counters.activeCycles
+            << ", \"idle_cycles\": " << sm.counters.idleCycles << ", \"blocks\": " << sm.counters.blocks
+            << ", \"occupancy\": " << ratio(sm.counters.warpCycles, sm.counters.activeCycles * sm.warps.size());
+        jsonFields(out, smTotal, sm.counters.activeCycles, warpSize);
+        out << ",\n     \"warps\": [\n";
+        for (size_t w = 0; w < sm.warps.size(); w++) {
+            out << "       {\"id\": " << sm.warps[w].id_;
+            jsonFields(out, sm.warps[w].counters, cycles, warpSize);
+            out << "}" << (w + 1 < sm.warps.size() ? "," : "") << "\n";
+        }
+        out << "     ]}" << (s + 1 < gpu.sms.size() ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"total\": {\"sms\": " << gpu.sms.size();
+    jsonFields(out, gpu.counterTotals(), cycles, warpSize);
+    out << "}\n}\n";
+}
+
+void writeCountersCsv(std::ostream& out, const GPU& gpu)
+{
+    const uint64_t cycles = static_cast<uint64_t>(gpu.get_cycle());
+    const int warpSize = gpu.config.warp_size;
+    RatioPrecision precision(out);
+
+    out << "scope,sm,warp,cycles";
+    forEachField(WarpCounters{}, 0, warpSize, [&](const std::string& name, auto) { out << "," << name; });
+    out << "\n";
+    auto row = [&](const char* scope, long sm, long warp, uint64_t rowCycles, const WarpCounters& c) {
+        out << scope << "," << sm << "," << warp << "," << rowCycles;
+        forEachField(c, rowCycles, warpSize, [&](const std::string&, auto value) { out << "," << value; });
+        out << "\n";
+    };
+
+    for (const auto& sm : gpu.sms) {
+        for (const auto& warp : sm.warps) row("warp", sm.id, warp.id_, cycles, warp.counters);
+    }
+    for (const auto& sm : gpu.sms) {
+        WarpCounters smTotal;
+        for (const auto& warp : sm.warps) smTotal += warp.counters;
+        row("sm", sm.id, -1, sm.counters.activeCycles, smTotal);
+    }
+    row("total", -1, -1, cycles, gpu.counterTotals());
+}
@@ -0,0 +1,150 @@
+#include "devmem.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+size_t DeviceMemory::pageSize()
+{
+    static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+static size_t pageRound(size_t bytes)
+{
+    const size_t page = DeviceMemory::pageSize();
+    return (bytes + page - 1) / page * page;
+}
+
+DeviceMemory::DeviceMemory(size_t words) : words(words), reserved(pageRound(std::max<size_t>(words * sizeof(float), 1)))
+{
+    void* m = ::mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m == MAP_FAILED)
+        throw std::runtime_error("global memory: cannot reserve " + std::to_string(reserved) + " bytes: " +
+                                 std::strerror(errno));
+    base = static_cast<float*>(m);
+}
+
+DeviceMemory::~DeviceMemory()
+{
+    for (const auto& m : mappings) {
+        if (m.mode == MapMode::WriteBack) ::msync(reinterpret_cast<char*>(base) + m.at, m.length, MS_SYNC);
+        if (m.fd >= 0) ::close(m.fd);
+    }
+    ::munmap(base, reserved);
+}
+
+void DeviceMemory::mapAt(const Mapping& m)
+{
+    const int prot = m.mode == MapMode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+    const int flags = (m.mode == MapMode::WriteBack ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED;
+    void* p = ::mmap(reinterpret_cast<char*>(base) + m.at, m.length, prot, flags, m.fd, static_cast<off_t>(m.offset));
+    if (p == MAP_FAILED)
+        throw std::runtime_error(std::string("global memory: mmap failed: ") + std::strerror(errno));
+}
+
+void DeviceMemory::checkRange(const Mapping& m) const
+{
+    const size_t page = pageSize();
+    if (m.at % page || m.offset % page || m.length == 0 || m.at > reserved || m.length > reserved - m.at)
+        throw std::invalid_argument("global memory: bad mapping range");
+    for (const auto& other : mappings) {
+        if (m.at < other.at + other.length && other.at < m.at + m.length)
+            throw std::invalid_argument("global memory: mapping overlaps another");
+    }
+}
+
+void DeviceMemory::add(const Mapping& m)
+{
+    mappings.push_back(m);
+    if (m.mode == MapMode::ReadOnly) {
+        // whole pages, as that is what the protection covers
+        const size_t last = std::min(words, (m.at + m.length) / sizeof(float));
+        readOnly.push_back({m.at / sizeof(float), last});
+    }
+}
+
+void DeviceMemory::map(size_t at, int fd, size_t offset, size_t bytes, MapMode mode)
+{
+    Mapping m{at, pageRound(bytes), -1, offset, mode};
+    checkRange(m);
+    m.fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (m.fd < 0) throw std::runtime_error(std::string("global memory: ") + std::strerror(errno));
+    try {
+        mapAt(m);
+    } catch (...) {
+        ::close(m.fd);
+        throw;
+    }
+    add(m);
+}
+
+// mremap with an old size of 0 maps the same pages a second time, which
+// the kernel only allows for shared mappings.
+void DeviceMemory::mapHost(size_t at, void* host, size_t bytes, MapMode mode)
+{
+    if (mode == MapMode::CopyOnWrite)
+        throw std::invalid_argument("global memory: host buffers cannot be mapped copy-on-write");
+    if (reinterpret_cast<uintptr_t>(host) % pageSize())
+        throw std::invalid_argument("global memory: host buffer is not page aligned");
+    Mapping m{at, pageRound(bytes), -1, 0, mode};
+    checkRange(m);
+    char* p = reinterpret_cast<char*>(base) + at;
+    if (::mremap(host, 0, m.length, MREMAP_MAYMOVE | MREMAP_FIXED, p) == MAP_FAILED)
+        throw std::invalid_argument(std::string("global memory: cannot alias host buffer (not shared memory?): ") +
+                                    std::strerror(errno));
+    if (mode == MapMode::ReadOnly && ::mprotect(p, m.length, PROT_READ) != 0) {
+        const int err = errno;
+        ::mmap(p, m.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        throw std::runtime_error(std::string("global memory: mprotect failed: ") + std::strerror(err));
+    }
+    add(m);
+}
+
+void DeviceMemory::unmap(size_t at)
+{
+    auto it = std::find_if(mappings.begin(), mappings.end(), [at](const Mapping& m) { return m.at == at; });
+    if (it == mappings.end()) throw std::invalid_argument("global memory: nothing mapped at " + std::to_string(at));
+    char* p = reinterpret_cast<char*>(base) + it->at;
+    if (it->mode == MapMode::WriteBack) ::msync(p, it->length, MS_SYNC);
+    void* m = ::mmap(p, it->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                     -1, 0);
+    if (m == MAP_FAILED)
+        throw std::runtime_error(std::string("global memory: cannot unmap: ") + std::strerror(errno));
+    if (it->fd >= 0) ::close(it->fd);
+    if (it->mode == MapMode::ReadOnly) {
+        const size_t first = it->at / sizeof(float);
+        readOnly.erase(std::find_if(readOnly.begin(), readOnly.end(),
+                                    [first](const std::pair<size_t, size_t>& r) { return r.first == first; }));
+    }
+    mappings.erase(it);
+}
+
+bool DeviceMemory::inReadOnly(size_t first, size_t count) const
+{
+    for (const auto& r : readOnly) {
+        if (first < r.second && r.first < first + count) return true;
+    }
+    return false;
+}
+
+void DeviceMemory::clear()
+{
+    std::vector<Mapping> sorted = mappings;
+    std::sort(sorted.begin(), sorted.end(), [](const Mapping& a, const Mapping& b) { return a.at < b.at; });
+    char* p = reinterpret_cast<char*>(base);
+    // private anonymous pages read back as zero once dropped, and their
+    // host memory is returned
+    size_t from = 0;
+    for (const auto& m : sorted) {
+        if (m.at > from) ::madvise(p + from, m.at - from, MADV_DONTNEED);
+        from = m.at + m.length;
+        if (m.mode == MapMode::CopyOnWrite) mapAt(m);
+    }
+    if (reserved > from) ::madvise(p + from, reserved - from, MADV_DONTNEED);
+}
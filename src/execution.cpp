@@ -1,70 +1,134 @@
 #include "execution.hpp"
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
-float fetch(const OpInfo& o, const ExecutionContext& ctx) {
+// TIDX is the global thread id for global memory, the thread's index in
+// its block for shared memory and the lane for registers. A register
+// holding a byte address resolves, with the offset added, to its word, or
+// -1 (out of bounds) if it is not a whole, word-aligned address, or
+// INEXACT_POINTER if a float register holds one too large to have been
+// held exactly.
+int resolveIndex(const DecodedOperand& o, const ExecutionContext& ctx, int lane) {
+    if (o.base >= 0) {
+        int64_t whole;
+        if (o.baseAddress) {
+            if (o.base >= ctx.warp.num_address_registers) return -1;
+            whole = ctx.warp.addr(o.base)[lane];
+            if (whole < 0 || whole > INT64_MAX - INT_MAX) return -1;
+        } else {
+            if (o.base >= ctx.warp.num_registers) return -1;
+            const float addr = ctx.warp.reg(o.base)[lane];
+            if (!(addr >= 0.0f)) return -1;
+            if (addr >= static_cast<float>(MAX_FLOAT_POINTER)) return INEXACT_POINTER;
+            whole = static_cast<int64_t>(addr);
+            if (whole != addr) return -1;
+        }
+        const int64_t bytes = whole + o.index;
+        if (bytes < 0 || bytes % sizeof(float) || bytes / int64_t(sizeof(float)) > INT_MAX) return -1;
+        return static_cast<int>(bytes / sizeof(float));
+    }
+    if (!o.tidx) return o.index;
     switch (o.kind) {
-        case OpKind::Constant: return o.constVal;
-        case OpKind::Register: return ctx.thread._registers[o.index];
-        case OpKind::Global: return ctx.globalMem[o.index];
-        case OpKind::Shared: return ctx.warp.memory[o.index];
-        case OpKind::Variable:
-            switch (o.var.loc) {
-                case StoreLoc::GLOBAL: return ctx.globalMem[o.index];
-                case StoreLoc::SHARED: return ctx.warp.memory[o.index];
-                case StoreLoc::LOCAL: return ctx.thread._registers[o.index];
-            }
-        default:
-            std::cerr << "ERROR in fetch: unsupported operand kind\n";
-            throw std::runtime_error("fetch error");
+        case OpKind::Global: return ctx.warp.threads[lane]->id();
+        case OpKind::Shared: return ctx.warp.blockThread + lane;
+        default: return lane;
     }
 }
 
-float eval(const OpInfo& lhs, const OpInfo& rhs, Opcode op, const ExecutionContext& ctx) {
-    float a = fetch(lhs, ctx);
-    float b = fetch(rhs, ctx);
+static float specialValue(int reg, const ExecutionContext& ctx, int lane) {
+    const KernelLaunch& launch = *ctx.block.launch;
+    const int tid = ctx.warp.blockThread + lane;
+    switch (static_cast<SpecialReg>(reg)) {
+        case SpecialReg::TidX: return static_cast<float>(tid % launch.block.x);
+        case SpecialReg::TidY: return static_cast<float>(tid / launch.block.x % launch.block.y);
+        case SpecialReg::TidZ: return static_cast<float>(tid / (launch.block.x * launch.block.y));
+        case SpecialReg::NtidX: return static_cast<float>(launch.block.x);
+        case SpecialReg::NtidY: return static_cast<float>(launch.block.y);
+        case SpecialReg::NtidZ: return static_cast<float>(launch.block.z);
+        case SpecialReg::CtaidX: return static_cast<float>(ctx.block.idx.x);
+        case SpecialReg::CtaidY: return static_cast<float>(ctx.block.idx.y);
+        case SpecialReg::CtaidZ: return static_cast<float>(ctx.block.idx.z);
+        case SpecialReg::NctaidX: return static_cast<float>(launch.grid.x);
+        case SpecialReg::NctaidY: return static_cast<float>(launch.grid.y);
+        case SpecialReg::NctaidZ: return static_cast<float>(launch.grid.z);
+        case SpecialReg::LaneId: return static_cast<float>(lane);
+        case SpecialReg::WarpId: return static_cast<float>(ctx.warp.blockThread / ctx.warp.width);
+    }
+    return 0.0f;
+}
 
-    switch (op) {
-        case Opcode::ADD: return a + b;
-        case Opcode::SUB: return a - b;
-        case Opcode::MUL: return a * b;
-        case Opcode::DIV:
-            if (b == 0.0f) throw std::runtime_error("DIV by zero");
-            return a / b;
-        case Opcode::MOV:
-            return b;
-        case Opcode::NEG:
-            return b*-1;
-        case Opcode::XOR:
-       
-            return static_cast<float>(static_cast<int>(a) ^ static_cast<int>(b));
-        case Opcode::OR:
-            return static_cast<float>(static_cast<int>(a) | static_cast<int>(b));
-        case Opcode::AND:   
-            return static_cast<float>(static_cast<int>(a) & static_cast<int>(b));
+static bool inBounds(int idx, size_t size) {
+    return idx >= 0 && static_cast<size_t>(idx) < size;
+}
 
+float fetch(const DecodedOperand& o, const ExecutionContext& ctx, int lane) {
+    int idx = resolveIndex(o, ctx, lane);
+    switch (o.kind) {
+        case OpKind::Constant: return o.constVal;
+        case OpKind::Register:
+            if (inBounds(idx, ctx.warp.num_registers)) return ctx.warp.reg(idx)[lane];
+            break;
+        case OpKind::Address:
+            if (inBounds(idx, ctx.warp.num_address_registers)) return static_cast<float>(ctx.warp.addr(idx)[lane]);
+            break;
+        case OpKind::Global:
+            if (inBounds(idx, ctx.globalMem.size())) return ctx.globalMem[idx];
+            break;
+        case OpKind::Shared:
+            if (inBounds(idx, ctx.block.memory.size())) return ctx.block.memory[idx];
+            break;
+        case OpKind::Special:
+            return specialValue(idx, ctx, lane);
+        case OpKind::Param:
+            if (inBounds(idx, ctx.block.launch->params.size())) return static_cast<float>(ctx.block.launch->params[idx]);
+            std::cerr << "ERROR in fetch: kernel has no %param" << idx << "\n";
+            throw std::runtime_error("fetch error");
         default:
-            throw std::runtime_error("eval unsupported opcode");
+            std::cerr << "ERROR in fetch: unsupported operand kind\n";
+            throw std::runtime_error("fetch error");
     }
+    if (idx == INEXACT_POINTER) {
+        std::cerr << "ERROR in fetch: pointer register r" << o.base << " holds an address past "
+                  << MAX_FLOAT_POINTER << ", which a float does not hold exactly; use an aN register\n";
+        throw std::runtime_error("fetch error");
+    }
+    std::cerr << "ERROR in fetch: index " << idx << " out of bounds\n";
+    throw std::runtime_error("fetch error");
+}
+
+double fetchWide(const DecodedOperand& o, const ExecutionContext& ctx, int lane) {
+    if (o.kind == OpKind::Address && inBounds(o.index, ctx.warp.num_address_registers))
+        return static_cast<double>(ctx.warp.addr(o.index)[lane]);
+    if (o.kind == OpKind::Param && inBounds(o.index, ctx.block.launch->params.size()))
+        return ctx.block.launch->params[o.index];
+    return fetch(o, ctx, lane);
 }
 
-ErrorCode storeInLocation(OpInfo& dst, float result, ExecutionContext& ctx) {
+ErrorCode storeInLocation(const DecodedOperand& dst, float result, ExecutionContext& ctx, int lane) {
+    int idx = resolveIndex(dst, ctx, lane);
+    if (idx == INEXACT_POINTER) return ErrorCode::InexactPointer;
     switch (dst.kind) {
         case OpKind::Register:
-            ctx.thread._registers[dst.index] = result;
+            if (!inBounds(idx, ctx.warp.num_registers)) return ErrorCode::InvalidMemorySpace;
+            ctx.warp.reg(idx)[lane] = result;
+            break;
+        case OpKind::Address:
+            if (!inBounds(idx, ctx.warp.num_address_registers)) return ErrorCode::InvalidMemorySpace;
+            // a whole number an int64 holds, or it was not an address
+            if (!(std::fabs(result) < 9.2e18f) || result != std::trunc(result)) return ErrorCode::InexactPointer;
+            ctx.warp.addr(idx)[lane] = static_cast<int64_t>(result);
             break;
         case OpKind::Global:
-            ctx.globalMem[dst.index] = result;
+            if (!inBounds(idx, ctx.globalMem.size())) return ErrorCode::GlobalOutOfBounds;
+            if (!ctx.globalMem.writable(idx)) return ErrorCode::ReadOnlyMemory;
+            ctx.globalStores.push_back({idx, result});
             break;
         case OpKind::Shared:
-            ctx.warp.memory[dst.index] = result;
-            break;
-        case OpKind::Variable:
-            switch (dst.var.loc) {
-                case StoreLoc::GLOBAL: ctx.globalMem[dst.index] = result; break;
-                case StoreLoc::SHARED: ctx.warp.memory[dst.index] = result; break;
-                case StoreLoc::LOCAL: ctx.thread._registers[dst.index] = result; break;
-            }
+            if (!inBounds(idx, ctx.block.memory.size())) return ErrorCode::SharedOutOfBounds;
+            ctx.block.memory[idx] = result;
             break;
         default:
             std::cerr << "ERROR in storing result\n";
@@ -72,3 +136,89 @@ ErrorCode storeInLocation(OpInfo& dst, float result, ExecutionContext& ctx) {
     }
     return ErrorCode::None;
 }
+
+float peekOperand(const DecodedOperand& o, const ExecutionContext& ctx, int lane) {
+    int idx = resolveIndex(o, ctx, lane);
+    switch (o.kind) {
+        case OpKind::Constant: return o.constVal;
+        case OpKind::Register:
+            return inBounds(idx, ctx.warp.num_registers) ? ctx.warp.reg(idx)[lane] : 0.0f;
+        case OpKind::Address:
+            return inBounds(idx, ctx.warp.num_address_registers) ? static_cast<float>(ctx.warp.addr(idx)[lane]) : 0.0f;
+        case OpKind::Global:
+            for (auto it = ctx.globalStores.rbegin(); it != ctx.globalStores.rend(); ++it) {
+                if (it->index == idx) return it->value;
+            }
+            return inBounds(idx, ctx.globalMem.size()) ? ctx.globalMem[idx] : 0.0f;
+        case OpKind::Shared:
+            return inBounds(idx, ctx.block.memory.size()) ? ctx.block.memory[idx] : 0.0f;
+        case OpKind::Special:
+            return specialValue(idx, ctx, lane);
+        case OpKind::Param:
+            return inBounds(idx, ctx.block.launch->params.size()) ? static_cast<float>(ctx.block.launch->params[idx]) : 0.0f;
+        default:
+            return 0.0f;
+    }
+}
+
+const float* fetchLanes(const DecodedOperand& o, const ExecutionContext& ctx, float* scratch) {
+    if (o.kind == OpKind::Register && !o.tidx) {
+        if (!inBounds(o.index, ctx.warp.num_registers)) {
+            std::cerr << "ERROR in fetch: register " << o.index << " out of bounds\n";
+            throw std::runtime_error("fetch error");
+        }
+        return ctx.warp.reg(o.index);
+    }
+    if (o.kind == OpKind::Constant) {
+        std::fill(scratch, scratch + ctx.warp.width, o.constVal);
+        return scratch;
+    }
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        scratch[lane] = laneActive(ctx.mask, lane) ? fetch(o, ctx, lane) : 0.0f;
+    }
+    return scratch;
+}
+
+ErrorCode storeLanes(const DecodedOperand& dst, const float* result, ExecutionContext& ctx) {
+    if (dst.kind == OpKind::Register && !dst.tidx) {
+        if (!inBounds(dst.index, ctx.warp.num_registers)) return ErrorCode::InvalidMemorySpace;
+        float* row = ctx.warp.reg(dst.index);
+        const LaneMask mask = ctx.mask;
+        const int width = ctx.warp.width;
+        for (int lane = 0; lane < width; lane++) {
+            row[lane] = laneActive(mask, lane) ? result[lane] : row[lane];
+        }
+        return ErrorCode::None;
+    }
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        ErrorCode err = storeInLocation(dst, result[lane], ctx, lane);
+        if (err != ErrorCode::None) return err;
+    }
+    return ErrorCode::None;
+}
+
+ErrorCode laneAddresses(const DecodedOperand& o, const ExecutionContext& ctx, int width, int* addrs) {
+    size_t size;
+    ErrorCode outside;
+    if (o.kind == OpKind::Global) {
+        size = ctx.globalMem.size();
+        outside = ErrorCode::GlobalOutOfBounds;
+    } else if (o.kind == OpKind::Shared) {
+        size = ctx.block.memory.size();
+        outside = ErrorCode::SharedOutOfBounds;
+    } else {
+        return ErrorCode::InvalidMemorySpace;
+    }
+    const bool perThread = o.tidx && o.base < 0;
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        int addr = resolveIndex(o, ctx, lane);
+        if (addr == INEXACT_POINTER) return ErrorCode::InexactPointer;
+        if (perThread) addr *= width;
+        if (addr < 0 || static_cast<size_t>(addr) + width > size) return outside;
+        if (addr % width) return ErrorCode::MisalignedAddress;
+        addrs[lane] = addr;
+    }
+    return ErrorCode::None;
+}
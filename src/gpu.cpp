@@ -1,96 +1,805 @@
 #include "gpu.hpp"
 #include "operations.hpp"
+#include "threaded.hpp"
+#include "banks.hpp"
 #include <iostream>
 #include <algorithm>
-#include "vartable.hpp"
-int Thread::_id = 0;
+#include <stdexcept>
+#include <climits>
 
-Thread::Thread() : id_(_id++), pc(0), _registers(NUM_REGISTERS, 0.0f), active(true), predicateReg(0) {}
-void Thread::printRegisters() const {
-    std::cout << "\nTHREAD: " << id_ << "\n";
-    for (size_t x = 0; x < _registers.size(); x++) {
-        std::cout << "REG: " << x << " VALUE: " << _registers[x] << "\n";
-    }
+Thread::Thread(int id) : pc(0), id_(id), active(true), predicateReg(0) {}
+
+Warp::Warp(int id, int width, int num_registers, int num_address_registers)
+    : id_(id), block(-1), blockThread(0), registers(static_cast<size_t>(num_registers) * width, 0.0f),
+      addresses(static_cast<size_t>(num_address_registers) * width, 0), kernel(0),
+      regReady(num_registers + num_address_registers, 0), predReady(0), nextIssue(0), width(width),
+      num_registers(num_registers), num_address_registers(num_address_registers) {
+    simtStack.reserve(8);
+}
+
+void Warp::resetTiming() {
+    std::fill(regReady.begin(), regReady.end(), 0);
+    predReady = 0;
+    memReady[0] = memReady[1] = 0;
+    nextIssue = 0;
 }
-void Thread::set_instruction(Instr instr) {
-    instruction = std::move(instr);
+
+void Warp::bindVars(size_t num_vars) {
+    varOffsets.assign(num_vars * width, -1);
 }
 
-Warp::Warp() : id_(0), memory(GLOBAL_MEM_SIZE, 0.0f) {
-    static int next_id = 0;
-    id_ = next_id++;
+void Warp::resetSimt(LaneMask lanes) {
+    simtStack.clear();
+    simtStack.push_back({0, NO_RECONVERGE, lanes});
 }
 
-bool Warp::isFinished() const {
-    for (const auto& t : threads) {
-        if (t->active) return false;
+void Warp::branch(size_t pc, size_t target, size_t rpc, LaneMask taken) {
+    SimtEntry& top = simtStack.back();
+    taken &= top.mask;
+    LaneMask notTaken = top.mask & ~taken;
+    if (!taken) {
+        top.pc = pc + 1;
+        return;
+    }
+    if (!notTaken) {
+        top.pc = target;
+        return;
+    }
+    // the current entry waits at the reconvergence point while each side
+    // runs on its own; the taken side goes first
+    top.pc = rpc;
+    if (pc + 1 != rpc) simtStack.push_back({pc + 1, rpc, notTaken});
+    if (target != rpc) simtStack.push_back({target, rpc, taken});
+}
+
+void Warp::retire(LaneMask lanes) {
+    for (auto& entry : simtStack) {
+        entry.mask &= ~lanes;
+    }
+    for (int lane = 0; lane < size(); lane++) {
+        if ((lanes >> lane) & 1u) threads[lane]->active = false;
+    }
+}
+
+void Warp::reconverge(size_t end) {
+    while (!simtStack.empty()) {
+        const SimtEntry& top = simtStack.back();
+        if (top.mask == 0 || top.pc == top.rpc) {
+            simtStack.pop_back();
+        } else if (top.pc >= end) {
+            // ran off the end of the program, same as HALT
+            retire(top.mask);
+        } else {
+            break;
+        }
     }
-    return true;
 }
 
 void Warp::addThread(std::shared_ptr<Thread> thread) {
     threads.push_back(thread);
 }
 
-void Warp::print_sharedMem() const {
-    for (const auto& i : memory) {
-        std::cout << i << ", ";
+void Warp::printRegisters() const {
+    for (int lane = 0; lane < size(); lane++) {
+        std::cout << "\nTHREAD: " << threads[lane]->id() << "\n";
+        for (int r = 0; r < num_registers; r++) {
+            std::cout << "REG: " << r << " VALUE: " << reg(r)[lane] << "\n";
+        }
+        for (int a = 0; a < num_address_registers; a++) {
+            std::cout << "ADDR: " << a << " VALUE: " << addr(a)[lane] << "\n";
+        }
     }
-    std::cout << "\n";
 }
 
-SM::SM(int sm_id, std::vector<float>& memory) : id(sm_id), globalMemory(memory), shared_pc(0) {}
+SM::SM(int sm_id, DeviceMemory& memory, const GpuConfig& config)
+    : id(sm_id), globalMemory(memory), trace(config.trace_capacity), traceLevel(TraceLevel::Off),
+      useThreaded(false), scheduler(makeScheduler(config.scheduler, config.warps_per_sm, config.two_level_active)),
+      timing(nullptr), issueWidth(config.issue_width), issuedThisCycle(0), nextReady(0), warpRetired(false),
+      shared_pc(0) {
+    if (config.caches) l1 = std::make_unique<Cache>(config.l1);
+    l2Latency = config.l2.latency;
+    blocks.resize(std::min(config.max_blocks_per_sm, config.warps_per_sm));
+    sharedFree = config.shared_mem_bytes / sizeof(float);
+}
 
 void SM::addWarp(const Warp& warp) {
     warps.push_back(warp);
 }
 
-void SM::cycle(const std::vector<Instr>& program) {
-    for (auto& warp : warps) {
-        if (warp.isFinished()) continue;
+// Warp slots are held at block granularity: a finished warp's slot stays
+// taken until the rest of its block is done.
+bool SM::warpFree(const Warp& warp) const {
+    return warp.isFinished() && warp.block < 0;
+}
 
-        shared_pc = 0;
-        for (const auto& t : warp.threads) {
-            if (t->active) {
-                shared_pc = t->pc;
-                break;
+bool SM::canHost(const KernelLaunch& launch) const {
+    if (launch.sharedWords > sharedFree) return false;
+    if (std::none_of(blocks.begin(), blocks.end(), [](const Block& b) { return b.id < 0; })) return false;
+    int free = 0;
+    for (const auto& warp : warps) {
+        if (warpFree(warp)) free++;
+    }
+    return free >= launch.warpsPerBlock;
+}
+
+void SM::startBlock(KernelLaunch& launch, int blockId) {
+    int slot = 0;
+    while (blocks[slot].id >= 0) slot++;
+    Block& block = blocks[slot];
+    block.id = blockId;
+    block.idx = {blockId % launch.grid.x, blockId / launch.grid.x % launch.grid.y,
+                 blockId / (launch.grid.x * launch.grid.y)};
+    block.memory.assign(launch.sharedWords, 0.0f);
+    block.launch = &launch;
+    sharedFree -= launch.sharedWords;
+    launch.residentBlocks++;
+
+    const int threads = launch.block.count();
+    size_t w = 0;
+    for (int k = 0; k < launch.warpsPerBlock; k++) {
+        while (!warpFree(warps[w])) w++;
+        Warp& warp = warps[w++];
+        warp.block = slot;
+        warp.blockThread = k * warp.width;
+        const int lanes = std::min(warp.width, threads - warp.blockThread);
+        for (int lane = 0; lane < warp.size(); lane++) {
+            Thread& t = *warp.threads[lane];
+            t.id_ = blockId * threads + warp.blockThread + lane;
+            t.pc = 0;
+            t.active = lane < lanes;
+            t.predicateReg = 0;
+        }
+        std::fill(warp.registers.begin(), warp.registers.end(), 0.0f);
+        std::fill(warp.addresses.begin(), warp.addresses.end(), 0);
+        warp.bindVars(launch.program->vars.size());
+        warp.kernel = launch.kernel;
+        warp.resetTiming();
+        warp.resetSimt(lanes >= 32 ? ~LaneMask(0) : (LaneMask(1) << lanes) - 1);
+    }
+}
+
+void SM::releaseBlocks() {
+    for (int slot = 0; slot < static_cast<int>(blocks.size()); slot++) {
+        Block& block = blocks[slot];
+        if (block.id < 0) continue;
+        bool done = std::all_of(warps.begin(), warps.end(), [slot](const Warp& warp) {
+            return warp.block != slot || warp.isFinished();
+        });
+        if (!done) continue;
+        for (auto& warp : warps) {
+            if (warp.block == slot) warp.block = -1;
+        }
+        block.id = -1;
+        sharedFree += block.memory.size();
+        block.launch->residentBlocks--;
+        counters.blocks++;
+    }
+    warpRetired = false;
+}
+
+void SM::cycle(uint64_t cycle) {
+    ready.resize(warps.size());
+    nextReady = UINT64_MAX;
+    for (size_t w = 0; w < warps.size(); w++) {
+        if (warps[w].isFinished()) {
+            ready[w] = 0;
+        } else if (!timing) {
+            ready[w] = 1;
+        } else {
+            uint64_t at = timing->readyAt(warps[w], programOf(warps[w]).code[warps[w].pc()]);
+            ready[w] = at <= cycle;
+            if (at > cycle) nextReady = std::min(nextReady, at);
+        }
+    }
+    issued.clear();
+    scheduler->select(ready, issueWidth, issued);
+    issuedThisCycle = static_cast<int>(issued.size());
+
+    stallOf.assign(warps.size(), -1);
+    uint64_t resident = 0;
+    for (size_t w = 0; w < warps.size(); w++) {
+        if (warps[w].isFinished()) continue;
+        resident++;
+        StallReason reason = ready[w] ? StallReason::NotSelected
+                             : warps[w].nextIssue > cycle ? StallReason::Pipeline
+                                                          : StallReason::Dependency;
+        stallOf[w] = static_cast<int8_t>(reason);
+    }
+    for (int w : issued) stallOf[w] = -1;
+    for (size_t w = 0; w < warps.size(); w++) {
+        if (stallOf[w] >= 0) warps[w].counters.stalls[stallOf[w]]++;
+    }
+    if (resident) {
+        counters.activeCycles++;
+        counters.warpCycles += resident;
+        if (issued.empty()) counters.idleCycles++;
+    }
+
+    for (int w : issued) {
+        Warp& warp = warps[w];
+        const Program& program = programOf(warp);
+        shared_pc = warp.pc();
+        const DecodedInstr& instruction = program.code[shared_pc];
+        const MemoryAccess access = execute(warp, instruction, program, cycle);
+        if (timing) timing->issue(warp, instruction, cycle, access);
+        if (warp.isFinished()) warpRetired = true;
+    }
+}
+
+// Issues what the scheduler picks with every unfinished warp ready, so warps
+// keep the relative progress the policy gives them, but with no timing,
+// trace or counters; cache tags are still updated. Returns the number issued.
+int SM::functionalCycle() {
+    ready.resize(warps.size());
+    for (size_t w = 0; w < warps.size(); w++) {
+        ready[w] = !warps[w].isFinished();
+    }
+    issued.clear();
+    scheduler->select(ready, issueWidth, issued);
+    for (int w : issued) {
+        Warp& warp = warps[w];
+        const Program& program = programOf(warp);
+        shared_pc = warp.pc();
+        const DecodedInstr& instruction = program.code[shared_pc];
+        ExecutionContext ctx{warp, globalMemory, pendingStores, program, blocks[warp.block], warp.activeMask()};
+        if (l1) warmCaches(ctx, instruction);
+        issue(ctx, instruction);
+        advance(warp, instruction, program, ctx.mask, ctx.taken);
+        if (warp.isFinished()) warpRetired = true;
+    }
+    issuedThisCycle = static_cast<int>(issued.size());
+    return issuedThisCycle;
+}
+
+// Every warp that was stalled stays stalled for the same reason; a warp
+// whose issue latency runs out part way is still counted as Pipeline.
+void SM::countSkipped(uint64_t cycles) {
+    if (isFinished()) return;
+    counters.activeCycles += cycles;
+    counters.idleCycles += cycles;
+    for (size_t w = 0; w < warps.size() && w < stallOf.size(); w++) {
+        if (stallOf[w] >= 0) warps[w].counters.stalls[stallOf[w]] += cycles;
+        if (!warps[w].isFinished()) counters.warpCycles += cycles;
+    }
+}
+
+// Stores are applied in the order they were issued, and SMs commit in id
+// order, so the result does not depend on how SMs were spread over workers.
+void SM::commitStores() {
+    for (const auto& st : pendingStores) {
+        globalMemory[st.index] = st.value;
+    }
+    pendingStores.clear();
+}
+
+bool SM::isFinished() const {
+    for (const auto& warp : warps) {
+        if (!warp.isFinished()) return false;
+    }
+    return true;
+}
+
+ErrorCode SM::issue(ExecutionContext& ctx, const DecodedInstr& instruction) {
+    if (useThreaded) return ctx.block.launch->threaded->issue(ctx, shared_pc);
+    return opcode_handlers[static_cast<int>(instruction.op)](ctx, instruction);
+}
+
+static void countLine(WarpCounters& counters, int level, bool write, const Cache::Access& a) {
+    uint64_t* events = counters.cache[level];
+    if (write) events[static_cast<int>(a.hit ? CacheEvent::WriteHit : CacheEvent::WriteMiss)]++;
+    else events[static_cast<int>(a.hit ? CacheEvent::ReadHit : CacheEvent::ReadMiss)]++;
+    if (a.evicted) events[static_cast<int>(CacheEvent::Eviction)]++;
+    if (a.writeback) events[static_cast<int>(CacheEvent::Writeback)]++;
+}
+
+// Calls f(line) for each distinct `lineBytes` line the sectors of
+// `request` fall in.
+template <typename F>
+static void forEachLine(const CoalescedRequest& request, uint64_t lineBytes, F f) {
+    for (int t = 0; t < request.transactions; t++) {
+        uint64_t last = UINT64_MAX;
+        for (int s = 0; s < SEGMENT_BYTES / SECTOR_BYTES; s++) {
+            if (!((request.sectorMask[t] >> s) & 1u)) continue;
+            const uint64_t line = (request.segment[t] + s * SECTOR_BYTES) / lineBytes * lineBytes;
+            if (line == last) continue;
+            last = line;
+            f(line);
+        }
+    }
+}
+
+// Whether memory operand `i` of `instruction` is written rather than read.
+static bool writesOperand(const DecodedInstr& instruction, int i) {
+    return i == 0 && (writesDestination(instruction.op) || instruction.op == Opcode::ST);
+}
+
+// Works out what the memory operands of `instruction`, addressed as it is
+// about to run, cost: global ones are coalesced and with caches looked up
+// in the L1, queueing what goes on to the L2; shared ones are checked for
+// bank conflicts. Operands that will fault are left to the instruction to
+// report.
+MemoryAccess SM::accessMemory(const ExecutionContext& ctx, const DecodedInstr& instruction, uint64_t cycle) {
+    MemoryAccess access;
+    const size_t queued = l2Queue.size();
+    const int warpIndex = static_cast<int>(&ctx.warp - warps.data());
+    const int width = instruction.op == Opcode::LD || instruction.op == Opcode::ST ? instruction.width : 1;
+    bool reads = false, l1Served = true;
+    for (int i = 0; i < instruction.numOperands; i++) {
+        const DecodedOperand& o = instruction.src[i];
+        if (o.kind != OpKind::Global && o.kind != OpKind::Shared) continue;
+        int words[MAX_WARP_SIZE];
+        if (laneAddresses(o, ctx, width, words) != ErrorCode::None) continue;
+        if (o.kind == OpKind::Shared) {
+            const BankAccess banks = bankAccess(words, ctx.mask, ctx.warp.size(), width);
+            const int conflicts = banks.conflicts();
+            ctx.warp.counters.sharedRequests++;
+            ctx.warp.counters.bankConflicts += conflicts;
+            access.bankReplays += std::max(banks.passes - 1, 0);
+            if (conflicts) bankConflictsAt[{ctx.block.launch->kernel, static_cast<uint32_t>(shared_pc)}] += conflicts;
+            continue;
+        }
+        CoalescedRequest request;
+        coalesce(words, ctx.mask, ctx.warp.size(), width, request);
+        ctx.warp.counters.countGlobal(request);
+        access.replays += std::max(request.transactions - 1, 0);
+        if (!l1) continue;
+
+        const bool write = writesOperand(instruction, i);
+        const bool writeThrough = l1->config().write == WritePolicy::WriteThrough;
+        reads = reads || !write;
+        forEachLine(request, static_cast<uint64_t>(l1->config().line_bytes), [&](uint64_t line) {
+            const Cache::Access a = l1->access(line, write);
+            countLine(ctx.warp.counters, 0, write, a);
+            if (a.writeback) l2Queue.push_back({a.victim, true, warpIndex, nullptr, 0});
+            if (write && writeThrough) l2Queue.push_back({line, true, warpIndex, nullptr, 0});
+            if (!write && !a.hit) {
+                l2Queue.push_back({line, false, warpIndex, &instruction, 0});
+                l1Served = false;
             }
+        });
+    }
+    if (l1 && reads) {
+        access.globalLatency = l1Served ? l1->config().latency : l2Latency;
+        // reads the L2 misses wait for DRAM instead
+        if (timing) {
+            const uint64_t missReady = timing->resultReady(instruction, cycle, {access.replays, -1});
+            for (size_t q = queued; q < l2Queue.size(); q++) l2Queue[q].missReady = missReady;
         }
+    }
+    return access;
+}
 
-        const Instr& instruction = program[shared_pc];
+// The global part of accessMemory() with nothing counted or timed, for
+// functional cycles: the L1 and the queued L2 lookups see the lines a
+// detailed run would, so caches are warm when detailed simulation resumes.
+void SM::warmCaches(const ExecutionContext& ctx, const DecodedInstr& instruction) {
+    const int warpIndex = static_cast<int>(&ctx.warp - warps.data());
+    const int width = instruction.op == Opcode::LD || instruction.op == Opcode::ST ? instruction.width : 1;
+    const bool writeThrough = l1->config().write == WritePolicy::WriteThrough;
+    for (int i = 0; i < instruction.numOperands; i++) {
+        const DecodedOperand& o = instruction.src[i];
+        int words[MAX_WARP_SIZE];
+        if (o.kind != OpKind::Global || laneAddresses(o, ctx, width, words) != ErrorCode::None) continue;
+        CoalescedRequest request;
+        coalesce(words, ctx.mask, ctx.warp.size(), width, request);
+        const bool write = writesOperand(instruction, i);
+        forEachLine(request, static_cast<uint64_t>(l1->config().line_bytes), [&](uint64_t line) {
+            const Cache::Access a = l1->access(line, write);
+            if (a.writeback) l2Queue.push_back({a.victim, true, warpIndex, nullptr, 0});
+            if (write && writeThrough) l2Queue.push_back({line, true, warpIndex, nullptr, 0});
+            if (!write && !a.hit) l2Queue.push_back({line, false, warpIndex, nullptr, 0});
+        });
+    }
+}
 
-        execute(warp, instruction);
+void SM::drainL2(Cache& l2, bool count) {
+    for (const auto& a : l2Queue) {
+        Warp& warp = warps[a.warp];
+        const Cache::Access result = l2.access(a.address, a.write);
+        if (count) countLine(warp.counters, 1, a.write, result);
+        if (!result.hit && a.instr && timing) timing->delayResult(warp, *a.instr, a.missReady);
     }
+    l2Queue.clear();
 }
 
-void SM::execute(Warp& warp, const Instr& instruction) {
-    HandlerFn fn = opcode_handlers[static_cast<int>(instruction.op)];
-    for (auto& thread : warp.threads) {
-        if (!thread->active) continue;
-        fn(*thread, warp, globalMemory, instruction);
-        if (thread->active) thread->pc++;
+MemoryAccess SM::execute(Warp& warp, const DecodedInstr& instruction, const Program& program, uint64_t cycle) {
+    ExecutionContext ctx{warp, globalMemory, pendingStores, program, blocks[warp.block], warp.activeMask()};
+    const MemoryAccess access = accessMemory(ctx, instruction, cycle);
+    if (traceLevel == TraceLevel::Off) {
+        issue(ctx, instruction);
+    } else {
+        TraceRecord rec{};
+        rec.cycle = cycle;
+        rec.sm = static_cast<uint16_t>(id);
+        rec.kernel = static_cast<uint16_t>(ctx.block.launch->kernel);
+        rec.warp = static_cast<uint32_t>(warp.id_);
+        rec.laneMask = ctx.mask;
+        rec.pc = static_cast<uint32_t>(shared_pc);
+        rec.opcode = static_cast<uint8_t>(instruction.op);
+        int lane = ctx.mask ? __builtin_ctz(ctx.mask) : -1;
+        bool values = traceLevel == TraceLevel::Operands && lane >= 0;
+        if (values) {
+            for (int i = 0; i < instruction.numOperands; i++) {
+                rec.operands[i] = peekOperand(instruction.src[i], ctx, lane);
+            }
+        }
+        rec.error = static_cast<uint8_t>(issue(ctx, instruction));
+        if (values) {
+            rec.hasValues = 1;
+            if (instruction.numOperands > 0) rec.result = peekOperand(instruction.src[0], ctx, lane);
+        }
+        trace.push(rec);
     }
+    warp.counters.count(instruction, ctx.mask, ctx.taken);
+    advance(warp, instruction, program, ctx.mask, ctx.taken);
+    return access;
 }
 
-GPU::GPU(const std::vector<Instr>& program) : program(program), global_memory(GLOBAL_MEM_SIZE, 0.0f), cycle_count(0) {
-    sms.emplace_back(0, global_memory);
-    for (int i = 0; i < NUM_THREADS; i++) {
-        Thread t;
-        all_threads.push_back(std::make_shared<Thread>(t));
+// Moves the warp past the instruction it just issued at shared_pc.
+void SM::advance(Warp& warp, const DecodedInstr& instruction, const Program& program, LaneMask mask, LaneMask taken) {
+    const size_t pc = shared_pc;
+    switch (instruction.op) {
+        case Opcode::HALT:
+            warp.retire(mask);
+            break;
+        case Opcode::JMP:
+            warp.branch(pc, static_cast<size_t>(instruction.src[0].index), program.reconverge[pc], taken);
+            break;
+        default:
+            warp.simtStack.back().pc = pc + 1;
+            break;
     }
-    for (int i = 0; i < NUM_THREADS; i += WARP_SIZE) {
-        Warp new_warp;
-        for (int j = 0; j < WARP_SIZE && (i + j) < NUM_THREADS; j++) {
-            new_warp.addThread(all_threads[i + j]);
+    // a jump past the end (or to an undefined label) ends the lane like
+    // running off the end does, so its pc is the end
+    const size_t end = program.code.size();
+    for (int lane = 0; lane < warp.size(); lane++) {
+        if (!laneActive(mask, lane) || !warp.threads[lane]->active) continue;
+        warp.threads[lane]->pc = laneActive(taken, lane) ? std::min(static_cast<size_t>(instruction.src[0].index), end)
+                                                         : pc + 1;
+    }
+    warp.reconverge(end);
+}
+
+GPU::GPU(const std::vector<Instr>& program, const GpuConfig& config)
+    : GPU(compileProgram(program), config) {}
+
+// Checked before global memory is reserved.
+static size_t globalWords(const GpuConfig& config) {
+    if (config.global_mem_bytes > MAX_GLOBAL_BYTES)
+        throw std::invalid_argument("GpuConfig: global_mem_bytes past " + std::to_string(MAX_GLOBAL_BYTES) +
+                                    ", the most word indices reach");
+    return config.global_mem_bytes / sizeof(float);
+}
+
+GPU::GPU(const Program& program, const GpuConfig& config)
+    : config(config), global_memory(globalWords(config)),
+      allocator(global_memory.size() * sizeof(float)), program(program), cycle_count(0) {
+    if (config.num_sms < 1 || config.warps_per_sm < 1 || config.registers_per_thread < 1)
+        throw std::invalid_argument("GpuConfig: SM, warp and register counts must be positive");
+    if (config.warp_size < 1 || config.warp_size > MAX_WARP_SIZE)
+        throw std::invalid_argument("GpuConfig: warp_size must be between 1 and " + std::to_string(MAX_WARP_SIZE));
+    if (config.issue_width < 1 || config.max_blocks_per_sm < 1)
+        throw std::invalid_argument("GpuConfig: issue_width and max_blocks_per_sm must be positive");
+    if (config.address_registers < 0)
+        throw std::invalid_argument("GpuConfig: address_registers must not be negative");
+
+    // both engines issue through the handler table, the threaded one for
+    // whatever it has no fast path for
+    setup_opcode_handlers();
+    sms.reserve(config.num_sms);
+    all_threads.reserve(config.total_threads());
+    for (int s = 0; s < config.num_sms; s++) {
+        sms.emplace_back(s, global_memory, config);
+        for (int w = 0; w < config.warps_per_sm; w++) {
+            Warp new_warp(s * config.warps_per_sm + w, config.warp_size, config.registers_per_thread,
+                          config.address_registers);
+            for (int lane = 0; lane < config.warp_size; lane++) {
+                auto thread = std::make_shared<Thread>(static_cast<int>(all_threads.size()));
+                all_threads.push_back(thread);
+                new_warp.addThread(thread);
+            }
+            sms[s].addWarp(new_warp);
         }
-        sms[0].addWarp(new_warp);
     }
+
+    int workers = config.host_threads > 0 ? config.host_threads
+                                          : static_cast<int>(std::thread::hardware_concurrency());
+    pool = std::make_unique<WorkerPool>(std::max(1, std::min(workers, config.num_sms)));
+    streams.resize(1);
+    bindProgram();
+    // without an explicit launch every SM runs one block filling all of
+    // its warps and shared memory
+    beginLaunch({config.num_sms, 1, 1}, {config.threads_per_sm(), 1, 1}, {},
+                config.shared_mem_bytes / sizeof(float));
+    if (config.caches) l2 = std::make_unique<Cache>(config.l2);
+    timing = std::make_unique<TimingModel>(config.timing);
+    setTiming(config.timing.enabled);
+    engine = config.engine;
+    schedulerPolicy = config.scheduler;
+    appliedScheduler = config.scheduler;
 }
 
 GPU::~GPU() {
     stop(); 
 }
 
+void GPU::load(const std::vector<Instr>& program)
+{
+    load(compileProgram(program));
+}
+
+void GPU::load(const Program& program)
+{
+    stop();
+    std::lock_guard<std::mutex> lock(mtx);
+    this->program = program;
+    bindProgram();
+}
+
+void GPU::launch(const Program& kernel, Dim3 grid, Dim3 block, const std::vector<double>& params, size_t shared_bytes)
+{
+    stop();
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t words = shared_bytes ? (shared_bytes + sizeof(float) - 1) / sizeof(float)
+                                : sharedWordsUsed(kernel, block.count());
+    // checked before anything changes so a rejected launch leaves the GPU as it was
+    // queued copies still have host pointers waiting to be filled
+    if (!streamsIdle()) throw std::logic_error("launch: streams have work queued");
+    checkLaunch(grid, block, words);
+    allocator.newLaunch();
+    program = kernel;
+    bindProgram();
+    beginLaunch(grid, block, params, words);
+    finished = false;
+}
+
+// Shared words the kernel touches: past the highest fixed address, or the
+// whole block if it indexes shared memory by thread. Addresses held in
+// registers are not known until run time, so kernels using sm[rN] pass
+// their size to launch().
+size_t GPU::sharedWordsUsed(const Program& kernel, int blockThreads)
+{
+    size_t words = 0;
+    auto reach = [&](const DecodedOperand& o, size_t width) {
+        if (o.kind != OpKind::Shared || o.base >= 0) return;
+        words = std::max(words, (o.tidx ? static_cast<size_t>(blockThreads) : static_cast<size_t>(o.index) + 1) * width);
+    };
+    for (const auto& d : kernel.code) {
+        for (int i = 0; i < d.numOperands; i++) reach(d.src[i], d.width);
+    }
+    for (const auto& v : kernel.vars) {
+        if (v.loc == StoreLoc::SHARED) words = std::max(words, v.threadIDX ? static_cast<size_t>(blockThreads) : static_cast<size_t>(v.offset) + 1);
+    }
+    return words;
+}
+
+void GPU::checkLaunch(Dim3 grid, Dim3 block, size_t sharedWords) const
+{
+    if (grid.x < 1 || grid.y < 1 || grid.z < 1 || block.x < 1 || block.y < 1 || block.z < 1)
+        throw std::invalid_argument("launch: grid and block dimensions must be positive");
+    // Dim3::count() and the thread ids are ints
+    if (int64_t(grid.x) * grid.y * grid.z * block.x * block.y * block.z > INT_MAX)
+        throw std::invalid_argument("launch: more than " + std::to_string(INT_MAX) + " threads");
+    const int warps = (block.count() + config.warp_size - 1) / config.warp_size;
+    if (warps > config.warps_per_sm)
+        throw std::invalid_argument("launch: a block of " + std::to_string(block.count()) + " threads needs " +
+                                    std::to_string(warps) + " warps, an SM has " +
+                                    std::to_string(config.warps_per_sm));
+    if (sharedWords * sizeof(float) > config.shared_mem_bytes)
+        throw std::invalid_argument("launch: " + std::to_string(sharedWords * sizeof(float)) +
+                                    " bytes of shared memory per block, an SM has " +
+                                    std::to_string(config.shared_mem_bytes));
+}
+
+// Empties every SM and queues the blocks of a new launch. The streams must
+// be idle: their queued work would be lost.
+void GPU::beginLaunch(Dim3 grid, Dim3 block, const std::vector<double>& params, size_t sharedWords)
+{
+    checkLaunch(grid, block, sharedWords);
+    kernel = KernelLaunch{};
+    kernel.program = &program;
+    kernel.threaded = threaded.get();
+    kernel.grid = grid;
+    kernel.block = block;
+    kernel.params = params;
+    kernel.sharedWords = sharedWords;
+    kernel.warpsPerBlock = (block.count() + config.warp_size - 1) / config.warp_size;
+    for (auto& sm : sms) {
+        for (auto& b : sm.blocks) b.id = -1;
+        sm.sharedFree = config.shared_mem_bytes / sizeof(float);
+        sm.warpRetired = false;
+        sm.pendingStores.clear();
+        for (auto& warp : sm.warps) {
+            warp.block = -1;
+            warp.simtStack.clear();
+            for (auto& t : warp.threads) t->active = false;
+        }
+    }
+    nextSm = 0;
+    dispatchBlocks();
+}
+
+bool GPU::dispatchBlocks()
+{
+    for (auto& sm : sms) {
+        if (sm.warpRetired) sm.releaseBlocks();
+    }
+    advanceStreams();
+    const int n = static_cast<int>(sms.size());
+    bool started = false;
+    // launches are served oldest first; one whose blocks do not fit
+    // anywhere lets a later one with smaller blocks fill the gaps
+    auto dispatch = [&](KernelLaunch& launch) {
+        while (!launch.allStarted()) {
+            int s = 0;
+            while (s < n && !sms[(nextSm + s) % n].canHost(launch)) s++;
+            if (s == n) break;
+            s = (nextSm + s) % n;
+            sms[s].startBlock(launch, launch.nextBlock++);
+            nextSm = (s + 1) % n;
+            started = true;
+        }
+    };
+    dispatch(kernel);
+    for (auto& launch : streamLaunches) dispatch(launch);
+    return started;
+}
+
+// Sizes per-program state (variable slots, threaded code) for `program`.
+void GPU::bindProgram()
+{
+    threaded = std::make_unique<ThreadedProgram>(program, config.registers_per_thread);
+    kernel.program = &program;
+    kernel.threaded = threaded.get();
+    for (auto& launch : streamLaunches) {
+        if (launch.kernel == 0) launch.threaded = threaded.get();
+    }
+    for (auto& sm : sms) {
+        for (auto& warp : sm.warps) {
+            warp.bindVars(program.vars.size());
+            warp.kernel = 0;
+        }
+    }
+}
+
+void GPU::setTiming(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto& sm : sms) {
+        sm.timing = enabled ? timing.get() : nullptr;
+        // results of instructions issued without timing are all ready
+        for (auto& warp : sm.warps) warp.resetTiming();
+    }
+    timingEnabled = enabled;
+}
+
+uint64_t GPU::stepFunctional()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (isFinished()) return 0;
+    for (auto& sm : sms) sm.useThreaded = engine == Engine::Threaded;
+    pool->parallel_for(static_cast<int>(sms.size()), [this](int i) {
+        sms[i].functionalCycle();
+    });
+    uint64_t issued = 0;
+    for (auto& sm : sms) {
+        sm.commitStores();
+        if (l2) sm.drainL2(*l2, false);
+        issued += sm.issuedThisCycle;
+    }
+    dispatchBlocks();
+    cycle_count++;
+    return issued;
+}
+
+void GPU::applyScheduler(SchedulerPolicy policy)
+{
+    for (auto& sm : sms) {
+        sm.scheduler = makeScheduler(policy, config.warps_per_sm, config.two_level_active);
+    }
+    appliedScheduler = policy;
+}
+
+bool GPU::isFinished() const
+{
+    if (!kernel.allStarted() || !streamsIdle()) return false;
+    for (const auto& sm : sms) {
+        if (!sm.isFinished()) return false;
+    }
+    return true;
+}
+
+bool GPU::step()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (isFinished()) return false;
+
+    const TraceLevel level = traceLevel;
+    for (auto& sm : sms) {
+        sm.traceLevel = level;
+        sm.useThreaded = engine == Engine::Threaded;
+    }
+    if (schedulerPolicy != appliedScheduler) applyScheduler(schedulerPolicy);
+    pool->parallel_for(static_cast<int>(sms.size()), [this](int i) {
+        sms[i].cycle(static_cast<uint64_t>(cycle_count));
+    });
+    // stores land before stream copies read memory
+    for (auto& sm : sms) {
+        sm.commitStores();
+        if (l2) sm.drainL2(*l2);
+    }
+    // blocks that start now can issue next cycle, so none are skipped
+    const bool started = dispatchBlocks();
+    uint64_t next = static_cast<uint64_t>(cycle_count) + 1;
+    if (!started) {
+        // nothing issued anywhere: jump to the first cycle a warp wakes up
+        // or a copy completes
+        uint64_t wake = copyWake();
+        for (const auto& sm : sms) {
+            if (sm.issuedThisCycle > 0) {
+                wake = next;
+                break;
+            }
+            wake = std::min(wake, sm.nextReady);
+        }
+        if (wake != UINT64_MAX) next = std::max(next, wake);
+        // never skip past the end of a RunMode::Cycles run
+        if (runMode == RunMode::Cycles && cycleLimit > cycle_count)
+            next = std::min(next, static_cast<uint64_t>(cycleLimit.load()));
+        if (next > static_cast<uint64_t>(cycle_count) + 1) {
+            for (auto& sm : sms) sm.countSkipped(next - cycle_count - 1);
+        }
+    }
+    cycle_count = static_cast<long long>(next);
+    return !isFinished();
+}
+
+static const char* stopReasonText(StopReason reason)
+{
+    switch (reason) {
+        case StopReason::Finished: return "finished";
+        case StopReason::CycleLimit: return "cycle limit";
+        case StopReason::Breakpoint: return "breakpoint";
+        case StopReason::Stopped: return "stopped";
+    }
+    return "?";
+}
+
+StopReason GPU::runLoop()
+{
+    while (running) {
+        const RunMode mode = runMode;
+        if (mode == RunMode::Cycles && cycle_count >= cycleLimit) return StopReason::CycleLimit;
+        if (!step()) return StopReason::Finished;
+        if (mode == RunMode::Breakpoint && atBreakpoint()) return StopReason::Breakpoint;
+        if (mode == RunMode::Paced) {
+            // woken early by stop() or a switch to another mode
+            std::unique_lock<std::mutex> lock(paceMtx);
+            paceCv.wait_for(lock, std::chrono::milliseconds(paceMs.load()),
+                            [this] { return !running || runMode != RunMode::Paced; });
+        }
+    }
+    return StopReason::Stopped;
+}
+
+StopReason GPU::runBlocking()
+{
+    stop();
+    running = true;
+    finished = false;
+    StopReason reason;
+    try {
+        reason = runLoop();
+    } catch (...) {
+        running = false;
+        throw;
+    }
+    stopReason = reason;
+    finished = reason == StopReason::Finished;
+    running = false;
+    return reason;
+}
+
 void GPU::run()
 {
     stop();
@@ -99,61 +808,127 @@ void GPU::run()
 
     worker = std::thread([this]() {
         std::cout << "--- Simulation Starting ---"<< std::endl;
-        bool all_sms_finished = false; 
-
-        while (running && !all_sms_finished) {
-            all_sms_finished = true;
-            {
-                std::lock_guard<std::mutex> lock(mtx);
-                for (auto& sm : sms) {
-                    sm.cycle(program);
-                    for (const auto& warp : sm.warps) {
-                        if (!warp.isFinished()) {
-                            all_sms_finished = false;
-                        }
-                    }
-                }
-                for(auto& var:VarTable::getInstance().table){
-                    switch (var.second.loc)
-                    {
-                    case StoreLoc::GLOBAL:
-                        var.second.value = global_memory[var.second.offset];
-                        break;
-                    case StoreLoc::LOCAL:
-                        var.second.value = this->all_threads[0]->_registers[var.second.offset];
-                        break;
-                    case StoreLoc::SHARED:
-                        //temp solution
-                        var.second.value = this->sms[0].warps[0].memory[var.second.offset];
-                        break;
-                    default:
-                        break;
-                    }
-                }
-            cycle_count++;
-            std::cout.flush(); 
-                
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(DELAY_TIME)); 
-        }
 
-        finished = true;
-        std::cout << "\n--- Simulation Finished in " << cycle_count << " cycles ---"<< std::endl;
+        StopReason reason = runLoop();
+        stopReason = reason;
+        finished = reason == StopReason::Finished;
+        running = false;
+        if (finished)
+            std::cout << "\n--- Simulation Finished in " << cycle_count << " cycles ---"<< std::endl;
+        else
+            std::cout << "\n--- Simulation paused at cycle " << cycle_count << " (" << stopReasonText(reason) << ") ---"<< std::endl;
     });
 
 }
 
+void GPU::runFor(long long cycles)
+{
+    stop();
+    cycleLimit = cycle_count + cycles;
+    runMode = RunMode::Cycles;
+    run();
+}
+
+void GPU::setRunMode(RunMode mode)
+{
+    runMode = mode;
+    paceCv.notify_all();
+}
+
+void GPU::setPace(int ms)
+{
+    paceMs = std::max(0, ms);
+    paceCv.notify_all();
+}
+
+void GPU::addBreakpoint(size_t pc)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (pc >= breakpoints.size()) breakpoints.resize(pc + 1, 0);
+    breakpoints[pc] = 1;
+}
+
+void GPU::removeBreakpoint(size_t pc)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (pc < breakpoints.size()) breakpoints[pc] = 0;
+}
+
+void GPU::clearBreakpoints()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    breakpoints.clear();
+}
+
+std::vector<size_t> GPU::getBreakpoints()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    std::vector<size_t> pcs;
+    for (size_t pc = 0; pc < breakpoints.size(); pc++) {
+        if (breakpoints[pc]) pcs.push_back(pc);
+    }
+    return pcs;
+}
+
+bool GPU::atBreakpoint()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& sm : sms) {
+        for (const auto& warp : sm.warps) {
+            if (warp.isFinished()) continue;
+            size_t pc = warp.pc();
+            if (pc < breakpoints.size() && breakpoints[pc]) return true;
+        }
+    }
+    return false;
+}
+
 void GPU::stop()
 {
     running = false;
+    paceCv.notify_all();
     if (worker.joinable()) worker.join();
 }
 
+WarpCounters GPU::counterTotals() const
+{
+    WarpCounters total;
+    for (const auto& sm : sms) {
+        for (const auto& warp : sm.warps) total += warp.counters;
+    }
+    return total;
+}
+
+std::map<std::pair<int, uint32_t>, uint64_t> GPU::bankConflictsByInstruction() const
+{
+    std::map<std::pair<int, uint32_t>, uint64_t> total;
+    for (const auto& sm : sms) {
+        for (const auto& [at, passes] : sm.bankConflictsAt) total[at] += passes;
+    }
+    return total;
+}
+
+std::vector<TraceRecord> GPU::traceSnapshot() const
+{
+    std::vector<TraceRecord> records;
+    for (const auto& sm : sms) {
+        sm.trace.snapshot(records);
+    }
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord& a, const TraceRecord& b) {
+        return a.cycle != b.cycle ? a.cycle < b.cycle : a.sm < b.sm;
+    });
+    return records;
+}
+
 void GPU::print_shared_mem() const {
     std::cout << "\n";
     for (const auto& sm : sms) {
-        for (const auto& warp : sm.warps) {
-            warp.print_sharedMem();
+        for (const auto& block : sm.blocks) {
+            if (block.memory.empty()) continue;
+            for (const auto& i : block.memory) {
+                std::cout << i << ", ";
+            }
+            std::cout << "\n";
         }
     }
     std::cout << "\n";
@@ -172,25 +947,33 @@ int GPU::get_cycle() const
 
 void GPU::reset() {
     stop();
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!streamsIdle()) throw std::logic_error("reset: streams have work queued");
     finished = false;
-        std::lock_guard<std::mutex> lock(mtx);
 
     cycle_count = 0;
     for(auto& sms: this->sms){
         sms.shared_pc = 0;
+        sms.pendingStores.clear();
+        sms.trace.clear();
+        sms.l2Queue.clear();
+        sms.bankConflictsAt.clear();
+        if (sms.l1) sms.l1->clear();
     }
-    for (auto& t : all_threads) {
-        t->pc = 0;
-        t->active = true;
-        std::fill(t->_registers.begin(), t->_registers.end(), 0.0f);
-    }
-    std::fill(global_memory.begin(), global_memory.end(), 0.0f);
+    global_memory.clear();
+    if (l2) l2->clear();
     for (auto& sm : sms) {
         for (auto& warp : sm.warps) {
-            std::fill(warp.memory.begin(), warp.memory.end(), 0.0f);
+            warp.bindVars(program.vars.size());
+            warp.kernel = 0;
+            warp.counters = WarpCounters{};
         }
+        for (auto& block : sm.blocks) block.memory.clear();
+        sm.counters = SmCounters{};
     }
-    
-    VarTable::getInstance().table.clear();
-
+    for (auto& event : events) event = Event{};
+    applyScheduler(schedulerPolicy);
+    // the same launch again from its first block
+    const KernelLaunch again = kernel;
+    beginLaunch(again.grid, again.block, again.params, again.sharedWords);
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+#include "binio.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A byte address in global memory. Kernels get them as %param values
+// (doubles, exact) and keep them in integer address registers, so every
+// byte of global memory can be handed out. Word indices are ints, which
+// bounds global memory at MAX_GLOBAL_BYTES.
+using DevicePtr = uint64_t;
+constexpr DevicePtr MAX_GLOBAL_BYTES = DevicePtr(1) << 33; // 8 GiB
+
+// Hands out global memory by byte address. Requests up to MAX_SMALL bytes
+// come from per-size-class pools (powers of two from MIN_CLASS) refilled a
+// CHUNK at a time; larger ones are first-fit from a list of free ranges
+// that merges neighbours again on release. Temporaries are bump-allocated
+// from an arena and freed by launch generation. The first ALIGN bytes are
+// never handed out, so 0 is a null pointer. Memory is not cleared.
+class DeviceAllocator {
+public:
+    static constexpr size_t MIN_CLASS = 16;
+    static constexpr size_t MAX_SMALL = 2048;
+    static constexpr size_t CHUNK = 4096; // pool refill and arena growth
+    static constexpr size_t ALIGN = 256;  // of large allocations and chunks
+
+    // Manages the first `bytes` of global memory.
+    explicit DeviceAllocator(size_t bytes);
+    // Throws std::bad_alloc when nothing fits.
+    DevicePtr allocate(size_t bytes);
+    // `bytes` rounded up to, and starting on, a multiple of `align` (itself
+    // a multiple of ALIGN); released with release() like any other.
+    DevicePtr allocateAligned(size_t bytes, size_t align);
+    // Throws std::invalid_argument for anything allocate() did not return.
+    void release(DevicePtr ptr);
+    // Lives until the second newLaunch() after it: through the launch it
+    // was made for, freed when the one after that starts.
+    DevicePtr allocateTemp(size_t bytes);
+    // Starts a launch's generation and returns the one the temporaries made
+    // so far belong to. Generations from `keepFrom` on are kept, for
+    // launches queued on streams that have not finished yet.
+    uint64_t newLaunch(uint64_t keepFrom = UINT64_MAX);
+    void releaseTemps();
+    // Everything free again.
+    void clear();
+
+    size_t bytesInUse() const { return inUse; } // live allocations, rounded up
+    size_t tempBytes() const { return temp; }
+
+    void save(std::string& out) const;
+    bool load(Reader& in);
+
+private:
+    struct ArenaChunk {
+        DevicePtr start;
+        uint64_t bytes;
+        uint64_t used;
+        uint64_t generation;
+    };
+    DevicePtr takeRange(size_t bytes, size_t align = ALIGN);
+    void giveRange(DevicePtr start, size_t bytes);
+    static int classOf(size_t bytes);
+
+    size_t limit;
+    std::map<DevicePtr, size_t> freeRanges;     // start -> bytes
+    std::vector<std::vector<DevicePtr>> pools;  // free blocks per size class
+    std::unordered_map<DevicePtr, size_t> live; // pointer -> bytes reserved for it
+    std::vector<ArenaChunk> arena;
+    uint64_t generation = 0;
+    size_t inUse = 0;
+    size_t temp = 0;
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include "instruction.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Text kernel format, one instruction per line:
+//
+//   ; comment (also # or //)
+//   DEF i GLOBAL 0 TIDX        ; DEF name GLOBAL|SHARED|LOCAL value offset|TIDX [CONST]
+//   DEF z LOCAL 10 2
+//   LOOP:                      ; label at this position
+//   MUL r0, r0, 3
+//   ADD i, i, 1
+//   CMP_LT i, z
+//   JMP LOOP
+//   HALT
+//
+// Operands are registers (r0, rTIDX), memory (gm3, smTIDX), launch values
+// (%tid.x, %ctaid.x, %ntid.x, %nctaid.x, %laneid, %warpid, %param0), numbers
+// or variable names. Commas between operands are optional.
+
+// Throws std::runtime_error("line N: ...") on a syntax error.
+std::vector<Instr> assemble(const std::string& source);
+std::string readKernelFile(const std::string& path);
+
+// Bump whenever Program or DecodedInstr change shape.
+constexpr uint32_t PROGRAM_FORMAT_VERSION = 7;
+
+uint64_t contentHash(const std::string& data);
+// Field-by-field encoding of an instruction, without struct padding, so
+// identical programs always produce identical bytes.
+void putInstr(std::string& out, const DecodedInstr& d);
+
+// Assembles and compiles a kernel file. With a cache directory, the
+// compiled Program is stored under the hash of the source and later loads
+// map that file and decode it instead of parsing again. The records are
+// read field by field and validated into a fresh Program rather than used
+// in place, so the mapping is released once loading returns.
+Program loadKernel(const std::string& path, const std::string& cacheDir = "");
+
+bool saveProgram(const Program& program, uint64_t key, const std::string& path);
+// Fails, leaving `program` alone, if the file is missing, stale or corrupt.
+bool loadProgram(const std::string& path, uint64_t key, Program& program);
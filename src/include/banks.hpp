@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+
+// Shared memory is split into SHARED_BANKS banks of 4-byte words, word w
+// in bank w % SHARED_BANKS, and each bank serves one word per pass. A
+// warp's access takes as many passes as the most distinct words asked of
+// one bank; lanes reading the same word share it (a broadcast) and lanes
+// writing the same word keep one of the stores, so neither conflicts.
+constexpr int SHARED_BANKS = 32;
+
+struct BankAccess {
+    int passes = 0; // passes the access takes
+    int words = 0;  // distinct words it touches
+    // passes past the fewest its words could take; a vector access of
+    // consecutive words needs several passes without any conflict
+    int conflicts() const { return passes - (words + SHARED_BANKS - 1) / SHARED_BANKS; }
+};
+
+// The banks the lanes in `mask` hit (word address words[lane], `width`
+// words each).
+BankAccess bankAccess(const int* words, uint32_t mask, int lanes, int width);
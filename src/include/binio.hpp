@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Little helpers for the raw binary formats (kernel cache, checkpoints).
+// Values are written in host byte order; files are not portable between
+// machines.
+
+inline void putString(std::string& out, const std::string& s)
+{
+    uint32_t len = static_cast<uint32_t>(s.size());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(s);
+}
+
+template <typename T>
+inline void put(std::string& out, const T& v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T>
+inline void putArray(std::string& out, const T* data, size_t count)
+{
+    out.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+// Bounds-checked reader over a buffer or mapped file.
+struct Reader {
+    const char* p;
+    const char* end;
+    template <typename T>
+    bool get(T& v)
+    {
+        if (end - p < static_cast<long>(sizeof(T))) return false;
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+    template <typename T>
+    bool getArray(T* data, size_t count)
+    {
+        size_t bytes = count * sizeof(T);
+        if (static_cast<size_t>(end - p) < bytes) return false;
+        if (bytes) std::memcpy(data, p, bytes); // data may be null when empty
+        p += bytes;
+        return true;
+    }
+    bool getString(std::string& s)
+    {
+        uint32_t len;
+        if (!get(len) || end - p < static_cast<long>(len)) return false;
+        s.assign(p, len);
+        p += len;
+        return true;
+    }
+};
+
+// Read-only private mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    const char* data() const { return static_cast<const char*>(map); }
+    size_t size() const { return length; }
+
+private:
+    void* map = nullptr;
+    size_t length = 0;
+};
+
+// Writes `data` to `path` through a shared mapping of a temporary file,
+// then renames it into place so readers never see a partial file.
+bool writeFileAtomic(const std::string& path, const std::string& data);
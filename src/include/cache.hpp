@@ -0,0 +1,56 @@
+#pragma once
+#include "config.hpp"
+#include "binio.hpp"
+#include "instruction.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A set-associative cache that keeps tags only: data always lives in
+// global memory, the cache just decides which level an access is served
+// from. Each line is a 32-bit word holding its tag and valid/dirty bits
+// plus one byte of replacement order, so looking up a 16-way set touches
+// 80 bytes of host memory.
+class Cache {
+public:
+    struct Access {
+        bool hit = false;
+        bool evicted = false;   // a valid line was replaced
+        bool writeback = false; // and it was dirty, so `victim` goes to the next level
+        uint64_t victim = 0;    // byte address of the replaced line
+    };
+
+    explicit Cache(const CacheConfig& config);
+    // Looks up the line holding byte address `address`, filling it on a
+    // miss unless the write policy says otherwise.
+    Access access(uint64_t address, bool write);
+    void clear();
+    const CacheConfig& config() const { return cfg; }
+
+    void save(std::string& out) const;
+    bool load(Reader& in);
+
+private:
+    static constexpr uint32_t VALID = 1;
+    static constexpr uint32_t DIRTY = 2;
+    static constexpr int TAG_SHIFT = 2;
+    void touch(uint8_t* rank, int way);
+
+    CacheConfig cfg;
+    uint64_t sets;
+    std::vector<uint32_t> lines; // set by set: tag << TAG_SHIFT | DIRTY | VALID
+    std::vector<uint8_t> order;  // per line, 0 = most recently used (LRU) or filled (FIFO)
+    uint32_t random;             // xorshift state for ReplacementPolicy::Random
+};
+
+// An access an L1 passed on to the L2. The SMs queue them while they
+// run in parallel and the GPU applies them at the end of the cycle in SM
+// order, so the shared L2 sees the same sequence however the SMs were
+// spread over host threads.
+struct L2Access {
+    uint64_t address;
+    bool write;
+    int warp;                  // index in the SM, for its counters
+    const DecodedInstr* instr; // read whose result a miss delays, or null
+    uint64_t missReady;        // until this cycle
+};
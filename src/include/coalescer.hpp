@@ -0,0 +1,22 @@
+#pragma once
+#include "config.hpp"
+#include <cstdint>
+
+// Global memory moves in 32-byte sectors, grouped into aligned 128-byte
+// segments. A warp's request costs one transaction per segment its lanes
+// touch, moving only the sectors they need: 32 lanes reading consecutive
+// words take one transaction, 32 lanes a segment apart take 32.
+constexpr int SECTOR_BYTES = 32;
+constexpr int SEGMENT_BYTES = 128;
+
+struct CoalescedRequest {
+    int transactions = 0; // segments touched
+    int sectors = 0;      // sectors moved, over all transactions
+    int bytes = 0;        // bytes the lanes asked for
+    uint64_t segment[MAX_WARP_SIZE];   // byte address of each transaction's segment, in lane order
+    uint8_t sectorMask[MAX_WARP_SIZE]; // sectors of the segment it moves, bit per sector
+};
+
+// Groups the accesses of the lanes in `mask` (word address words[lane],
+// `width` words each) into segment transactions.
+void coalesce(const int* words, uint32_t mask, int lanes, int width, CoalescedRequest& out);
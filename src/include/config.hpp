@@ -1,12 +1,101 @@
 #ifndef CONFIG_HPP
 #define CONFIG_HPP
-constexpr int NUM_THREADS = 10;
-constexpr int NUM_REGISTERS = 4;
-constexpr int GLOBAL_MEM_SIZE = NUM_THREADS;
-constexpr int WARP_SIZE = NUM_THREADS;
+#include <cstddef>
+constexpr int MAX_WARP_SIZE = 32; // lanes that fit in a LaneMask
 constexpr int SLEEP_TIME =1; // In seconds 
-constexpr size_t NUM_OPCODES = 13; 
+constexpr size_t NUM_OPCODES = 16; 
 constexpr int NUM_VAR_LOCS=3;
 constexpr int TIDX_RETURN_VAL = -1;
 constexpr int DELAY_TIME = 50;  
-#endif 
\ No newline at end of file
+
+// Handlers: look up opcode_handlers per instruction.
+// Threaded: pre-translated code with operand-specialized handlers.
+enum class Engine { Handlers, Threaded };
+
+// How GPU::run() advances the simulation (see gpu.hpp).
+// FreeRun: as fast as possible until the kernel finishes.
+// Cycles: until the cycle limit set with runFor()/setCycleLimit().
+// Breakpoint: until a warp is about to issue at a breakpoint pc.
+// Paced: one cycle every pace interval, for watching in the GUI.
+enum class RunMode { FreeRun, Cycles, Breakpoint, Paced };
+enum class StopReason { Finished, CycleLimit, Breakpoint, Stopped };
+
+// Which ready warps an SM issues from each cycle (see scheduler.hpp).
+enum class SchedulerPolicy { LooseRoundRobin, GreedyThenOldest, TwoLevel };
+
+struct OpLatency {
+    int issue;  // cycles before the warp may issue again
+    int result; // cycles before the destination may be read
+};
+
+// Timing model (see timing.hpp). Off by default, in which case every
+// warp instruction takes one cycle.
+struct TimingConfig {
+    bool enabled = false;
+    // indexed by Opcode:
+    //  ADD     SUB     MUL     DIV      NEG     LD      ST      MOV
+    //  HALT    DEF     LABEL   JMP      CMP_LT  AND     OR      XOR
+    OpLatency ops[NUM_OPCODES] = {
+        {1, 4}, {1, 4}, {1, 4}, {4, 16}, {1, 4}, {1, 1}, {1, 1}, {1, 4},
+        {1, 1}, {1, 1}, {1, 1}, {1, 1},  {1, 4}, {1, 4}, {1, 4}, {1, 4},
+    };
+    int global_latency = 400; // added to results read from global memory (from DRAM with caches)
+    int shared_latency = 30;  // added to results read from shared memory
+    // each transaction of a global access past its first replays the
+    // instruction: the warp issues, and its result arrives, this much later
+    int transaction_cycles = 4;
+    // likewise for each pass past the first of a shared access with bank conflicts
+    int bank_conflict_cycles = 2;
+};
+
+// Which line of a full set a cache replaces.
+enum class ReplacementPolicy { LRU, FIFO, Random };
+// WriteBack: a store allocates its line and marks it dirty; the line goes
+// to the next level when it is evicted. WriteThrough: stores always go on
+// to the next level and only update lines already cached.
+enum class WritePolicy { WriteBack, WriteThrough };
+
+// One level of the cache hierarchy (see cache.hpp).
+struct CacheConfig {
+    size_t size_bytes;
+    int line_bytes; // a multiple of the 32-byte sector
+    int ways;       // at most 255
+    ReplacementPolicy replacement;
+    WritePolicy write;
+    int latency; // cycles for a read that hits (with timing)
+};
+
+// Grid and block shapes for GPU::launch().
+struct Dim3 {
+    int x = 1;
+    int y = 1;
+    int z = 1;
+    int count() const { return x * y * z; }
+};
+
+// Device geometry, chosen when the GPU is constructed.
+struct GpuConfig {
+    int num_sms = 1;
+    int warps_per_sm = 1;
+    int warp_size = 32;
+    int registers_per_thread = 4;
+    int address_registers = 4; // a0.. per thread, for device pointers
+    size_t global_mem_bytes = 64 * 1024;
+    size_t shared_mem_bytes = 48 * 1024; // per SM, shared by the blocks resident on it
+    int max_blocks_per_sm = 32; // resident blocks per SM, also capped by warps_per_sm
+    int host_threads = 0; // workers simulating SMs, 0 = one per host core
+    size_t trace_capacity = 4096; // trace records kept per SM
+    Engine engine = Engine::Handlers;
+    SchedulerPolicy scheduler = SchedulerPolicy::LooseRoundRobin;
+    int issue_width = 1; // warps an SM may issue per cycle
+    int two_level_active = 4; // size of the two-level scheduler's active set
+    size_t copy_bytes_per_cycle = 32; // stream copy bandwidth, 0 = copies are instant
+    bool caches = false; // model an L1 per SM and an L2 they share
+    CacheConfig l1{16 * 1024, 128, 4, ReplacementPolicy::LRU, WritePolicy::WriteThrough, 30};
+    CacheConfig l2{512 * 1024, 128, 16, ReplacementPolicy::LRU, WritePolicy::WriteBack, 200};
+    TimingConfig timing;
+
+    int threads_per_sm() const { return warps_per_sm * warp_size; }
+    int total_threads() const { return num_sms * threads_per_sm(); }
+};
+#endif 
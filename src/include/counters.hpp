@@ -0,0 +1,65 @@
+#pragma once
+#include "config.hpp"
+#include "instruction.hpp"
+#include "coalescer.hpp"
+#include <cstdint>
+#include <ostream>
+
+// Why an unfinished warp did not issue in a cycle.
+enum class StallReason {
+    Dependency, // waiting on a register or predicate result (timing model)
+    Pipeline,   // still inside the issue latency of its last instruction
+    NotSelected // ready, but the scheduler issued other warps
+};
+constexpr int NUM_STALL_REASONS = 3;
+
+enum class MemSpace { Global, Shared };
+constexpr int NUM_MEM_SPACES = 2;
+
+// Line accesses seen by a cache level (see cache.hpp). An eviction
+// replaces a valid line; a writeback is an eviction of a dirty one.
+enum class CacheEvent { ReadHit, ReadMiss, WriteHit, WriteMiss, Eviction, Writeback };
+constexpr int NUM_CACHE_EVENTS = 6;
+constexpr int NUM_CACHE_LEVELS = 2; // L1, L2
+
+// Event counts for one warp. Only the worker simulating the owning SM
+// touches them, so they are plain integers.
+struct WarpCounters {
+    uint64_t issued = 0;               // warp instructions
+    uint64_t opcodes[NUM_OPCODES] = {};
+    uint64_t activeLanes = 0;          // summed over issued instructions
+    uint64_t stalls[NUM_STALL_REASONS] = {};
+    uint64_t memReads[NUM_MEM_SPACES] = {};  // per-thread accesses
+    uint64_t memWrites[NUM_MEM_SPACES] = {};
+    uint64_t branches = 0;
+    uint64_t divergentBranches = 0;    // JMPs that split the warp
+    uint64_t globalRequests = 0;       // warp-wide global accesses, one per operand
+    uint64_t globalTransactions = 0;   // segment transactions they took (see coalescer.hpp)
+    uint64_t globalSectors = 0;        // sectors those moved
+    uint64_t globalBytes = 0;          // bytes the lanes asked for
+    uint64_t cache[NUM_CACHE_LEVELS][NUM_CACHE_EVENTS] = {}; // caused by this warp, with GpuConfig::caches
+    uint64_t sharedRequests = 0;       // warp-wide shared accesses, one per operand
+    uint64_t bankConflicts = 0;        // passes they took past the fewest possible (see banks.hpp)
+
+    void count(const DecodedInstr& instr, uint32_t mask, uint32_t taken);
+    void countGlobal(const CoalescedRequest& request);
+    WarpCounters& operator+=(const WarpCounters& other);
+    WarpCounters& operator-=(const WarpCounters& other);
+};
+
+struct SmCounters {
+    uint64_t activeCycles = 0; // cycles with at least one unfinished warp
+    uint64_t idleCycles = 0;   // of those, cycles that issued nothing
+    uint64_t warpCycles = 0;   // unfinished warps summed over active cycles
+    uint64_t blocks = 0;       // thread blocks run to completion
+};
+
+const char* stallReasonName(StallReason reason);
+const char* cacheEventName(CacheEvent event);
+
+class GPU;
+// Counters of every SM and warp plus device totals, derived metrics
+// (IPC, lane utilization, achieved occupancy per SM) included.
+void writeCountersJson(std::ostream& out, const GPU& gpu);
+// One row per warp, then one per SM, then the device total.
+void writeCountersCsv(std::ostream& out, const GPU& gpu);
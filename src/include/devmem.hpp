@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// How a host file or buffer shows up in global memory (GPU::mapFile,
+// GPU::mapHost).
+// ReadOnly: kernel stores to it fail with ErrorCode::ReadOnlyMemory.
+// CopyOnWrite: writable; changes stay in the simulator and reset() drops them.
+// WriteBack: writable; changes go straight to the file.
+enum class MapMode { ReadOnly, CopyOnWrite, WriteBack };
+
+// Global memory: one anonymous mapping reserved up front and only backed
+// by host memory where it is touched, so a large device costs nothing
+// until used. Ranges of it can be replaced by mappings of host files,
+// which kernels then read and write in place, with no copy in between.
+class DeviceMemory {
+public:
+    explicit DeviceMemory(size_t words);
+    ~DeviceMemory();
+    DeviceMemory(const DeviceMemory&) = delete;
+    DeviceMemory& operator=(const DeviceMemory&) = delete;
+
+    float* data() { return base; }
+    const float* data() const { return base; }
+    size_t size() const { return words; }
+    float& operator[](size_t i) { return base[i]; }
+    const float& operator[](size_t i) const { return base[i]; }
+    float* begin() { return base; }
+    float* end() { return base + words; }
+    const float* begin() const { return base; }
+    const float* end() const { return base + words; }
+
+    // Maps `bytes` of `fd` starting at file offset `offset` over the
+    // memory at byte address `at`. `at` must be page aligned and the range
+    // must not overlap another mapping; `fd` is duplicated, so the caller
+    // may close it. Throws std::runtime_error if the mapping fails.
+    void map(size_t at, int fd, size_t offset, size_t bytes, MapMode mode);
+    // The same for `bytes` of host memory at `host`, which must be page
+    // aligned and shared memory (a MAP_SHARED mapping of a file, memfd,
+    // shm object or anonymous memory): the range at `at` becomes a second
+    // view of it. CopyOnWrite is not supported. Throws
+    // std::invalid_argument if `host` cannot be aliased.
+    void mapHost(size_t at, void* host, size_t bytes, MapMode mode);
+    // Flushes a WriteBack mapping and puts zeroed memory back.
+    void unmap(size_t at);
+    bool hasMappings() const { return !mappings.empty(); }
+    // True if kernels may store to word `word`, or to all of `count` words
+    // from `first`.
+    bool writable(size_t word) const { return readOnly.empty() || !inReadOnly(word, 1); }
+    bool writable(size_t first, size_t count) const { return readOnly.empty() || !inReadOnly(first, count); }
+    // Zeroes everything that is not a mapping and drops copy-on-write
+    // changes; WriteBack and ReadOnly mappings keep their contents.
+    void clear();
+
+    static size_t pageSize();
+
+private:
+    struct Mapping {
+        size_t at;
+        size_t length; // mapped bytes, whole pages
+        int fd;        // -1 for an alias of host memory (mapHost)
+        size_t offset; // page-aligned file offset mapped at `at`
+        MapMode mode;
+    };
+    bool inReadOnly(size_t first, size_t count) const;
+    void mapAt(const Mapping& m);
+    void checkRange(const Mapping& m) const;
+    void add(const Mapping& m);
+
+    float* base;
+    size_t words;
+    size_t reserved; // bytes, whole pages
+    std::vector<Mapping> mappings;
+    std::vector<std::pair<size_t, size_t>> readOnly; // word ranges [first, last)
+};
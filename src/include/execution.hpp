@@ -3,11 +3,38 @@
 #include "gpu.hpp"
 
 struct ExecutionContext {
-    Thread& thread;
     Warp& warp;
-    std::vector<float>& globalMem;
+    DeviceMemory& globalMem;
+    std::vector<GlobalStore>& globalStores; // committed at the end of the cycle
+    const Program& program;
+    Block& block; // the warp's thread block: shared memory and launch shape
+    LaneMask mask;
+    LaneMask taken = 0; // lanes whose branch was taken, set by JMP
 };
 
-float fetch(const OpInfo& o, const ExecutionContext& ctx);
-float eval(const OpInfo& lhs, const OpInfo& rhs, Opcode op, const ExecutionContext& ctx);
-ErrorCode storeInLocation(OpInfo& dst, float result, ExecutionContext& ctx);
+inline bool laneActive(LaneMask mask, int lane) { return (mask >> lane) & 1u; }
+
+// resolveIndex() of a gm[rN]/sm[rN] whose float register holds an address
+// at or past MAX_FLOAT_POINTER, which a float cannot be trusted to hold
+// exactly; gm[aN] has no such limit.
+constexpr int INEXACT_POINTER = -2;
+constexpr int64_t MAX_FLOAT_POINTER = int64_t(1) << 24; // 16 MiB
+int resolveIndex(const DecodedOperand& o, const ExecutionContext& ctx, int lane);
+float fetch(const DecodedOperand& o, const ExecutionContext& ctx, int lane);
+// Like fetch, but address registers and kernel parameters come out exact.
+double fetchWide(const DecodedOperand& o, const ExecutionContext& ctx, int lane);
+ErrorCode storeInLocation(const DecodedOperand& dst, float result, ExecutionContext& ctx, int lane);
+// Like fetch, but sees global stores not yet committed and never throws
+// (0 for operands without a value). Used for tracing.
+float peekOperand(const DecodedOperand& o, const ExecutionContext& ctx, int lane);
+
+// Warp-wide access: fetchLanes returns one value per lane, either the
+// register row itself or `scratch` filled for the active lanes.
+const float* fetchLanes(const DecodedOperand& o, const ExecutionContext& ctx, float* scratch);
+ErrorCode storeLanes(const DecodedOperand& dst, const float* result, ExecutionContext& ctx);
+
+// First word of each active lane's `width`-word access to a memory
+// operand, for LD/ST to gather or scatter through. A TIDX operand gives
+// each thread its own vector. Fails unless every access lies inside the
+// space and starts on a multiple of `width` words.
+ErrorCode laneAddresses(const DecodedOperand& o, const ExecutionContext& ctx, int width, int* addrs);
@@ -6,68 +6,392 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include "workerpool.hpp"
+#include "trace.hpp"
+#include "scheduler.hpp"
+#include "timing.hpp"
+#include "counters.hpp"
+#include "stream.hpp"
+#include "allocator.hpp"
+#include "devmem.hpp"
+#include "cache.hpp"
+#include <map>
+#include <list>
+
+using LaneMask = uint32_t;
+class ThreadedProgram;
 
 class Thread {
 public:
-    static int _id;
     size_t pc;
     int id_;
     bool active;
-    std::vector<float> _registers;
-    Instr instruction;
     int predicateReg;
-    Thread();
+    explicit Thread(int id);
     int id() const { return id_; }
-    void printRegisters() const;
-    void set_instruction(Instr instr);
 };
 
+// One level of a warp's reconvergence stack: the lanes in `mask` run from
+// `pc` until they reach `rpc`, where they rejoin the entry below.
+struct SimtEntry {
+    size_t pc;
+    size_t rpc;
+    LaneMask mask;
+};
+
+constexpr size_t NO_RECONVERGE = SIZE_MAX;
+
 class Warp {
 public:
     int id_;
     std::vector<std::shared_ptr<Thread>> threads;
-    std::vector<float> memory;
-    Warp();
-    bool isFinished() const;
+    // Block slot on the SM this warp belongs to, -1 while the warp slot is
+    // free, and the index within that block of its lane 0.
+    int block;
+    int blockThread;
+    // Register file laid out as [register][lane] so one register of every
+    // lane is contiguous and ALU ops can run across the warp at once.
+    std::vector<float> registers;
+    // Address registers (aN), laid out the same way. They hold byte
+    // addresses as integers so pointers stay exact past what a float holds.
+    std::vector<int64_t> addresses;
+    // Offset each lane's variable slot was DEF'd at, [slot][lane], -1 if
+    // the lane has not reached the DEF yet, for the variables of program
+    // handle `kernel` (GPU::kernelProgram), the last one the warp ran.
+    std::vector<int> varOffsets;
+    int kernel;
+    // SIMT state; the top entry is the path being executed. Empty once
+    // every lane has halted.
+    std::vector<SimtEntry> simtStack;
+    // Timing model state: the cycle each register's (rN, then aN) and the
+    // predicate's pending result lands, the cycle the warp's last pending write to
+    // global [0] and shared [1] memory lands, and the first cycle the warp
+    // may issue again.
+    std::vector<uint64_t> regReady;
+    uint64_t predReady;
+    uint64_t memReady[2] = {0, 0};
+    uint64_t nextIssue;
+    WarpCounters counters;
+    int width;
+    int num_registers;
+    int num_address_registers;
+    Warp(int id, int width, int num_registers, int num_address_registers);
+    float* reg(int r) { return &registers[r * width]; }
+    const float* reg(int r) const { return &registers[r * width]; }
+    int64_t* addr(int a) { return &addresses[a * width]; }
+    const int64_t* addr(int a) const { return &addresses[a * width]; }
+    int& varOffset(int slot, int lane) { return varOffsets[slot * width + lane]; }
+    int varOffset(int slot, int lane) const { return varOffsets[slot * width + lane]; }
+    void bindVars(size_t num_vars);
+    int size() const { return static_cast<int>(threads.size()); }
+    size_t pc() const { return simtStack.back().pc; }
+    LaneMask activeMask() const { return simtStack.empty() ? 0 : simtStack.back().mask; }
+    bool isFinished() const { return simtStack.empty(); }
+    // Starts the lanes in `lanes` at pc 0.
+    void resetSimt(LaneMask lanes);
+    void resetTiming();
+    // Splits the running path at the JMP at `pc` if only some lanes take it.
+    void branch(size_t pc, size_t target, size_t rpc, LaneMask taken);
+    // Removes halted lanes from every path.
+    void retire(LaneMask lanes);
+    // Pops paths that are empty or have reached their reconvergence point.
+    void reconverge(size_t end);
     void addThread(std::shared_ptr<Thread> thread);
-    void print_sharedMem() const;
+    void printRegisters() const;
+};
+
+// A kernel launch: the code it runs, the grid, the kernel's parameters and
+// what every block needs. Blocks are handed to SMs in order, nextBlock is
+// the first one still waiting.
+struct KernelLaunch {
+    const Program* program = nullptr;
+    const ThreadedProgram* threaded = nullptr;
+    int kernel = 0; // handle of the program (see GPU::addKernel), 0 = GPU::program
+    Dim3 grid;
+    Dim3 block;
+    std::vector<double> params; // double so that device pointers are exact
+    size_t sharedWords = 0; // per block
+    int warpsPerBlock = 0;
+    int nextBlock = 0;
+    int residentBlocks = 0; // started and not yet finished
+    int numBlocks() const { return grid.count(); }
+    bool allStarted() const { return nextBlock >= numBlocks(); }
+    bool done() const { return allStarted() && residentBlocks == 0; }
+};
+
+// A thread block resident on an SM. Its warps keep their slots until the
+// last one finishes; the shared memory stays readable until the slot is
+// reused.
+struct Block {
+    int id = -1; // linear index in the grid, -1 if the slot is free
+    Dim3 idx;
+    std::vector<float> memory;
+    KernelLaunch* launch = nullptr;
+};
+
+// A global memory write held back until the end of the cycle so that SMs
+// simulated on different host threads never race on global memory.
+struct GlobalStore {
+    int index;
+    float value;
 };
 
 class SM {
 public:
     int id;
     std::vector<Warp> warps;
-    std::vector<float>& globalMemory;
-    size_t shared_pc;
-    SM(int sm_id, std::vector<float>& memory);
+    std::vector<Block> blocks; // resident block slots
+    size_t sharedFree;         // words not held by a resident block
+    DeviceMemory& globalMemory;
+    std::vector<GlobalStore> pendingStores;
+    TraceBuffer trace;
+    TraceLevel traceLevel;
+    bool useThreaded; // issue from the launches' threaded code, not the handler table
+    std::unique_ptr<WarpScheduler> scheduler;
+    const TimingModel* timing; // null when every instruction takes one cycle
+    int issueWidth;
+    int issuedThisCycle;
+    uint64_t nextReady; // earliest cycle a stalled warp can issue
+    bool warpRetired;   // a warp finished this cycle, so a block may be done
+    SmCounters counters;
+    std::unique_ptr<Cache> l1;      // null unless GpuConfig::caches
+    std::vector<L2Access> l2Queue;  // what the L1 passed on this cycle
+    int l2Latency;                  // of a read the L2 serves
+    std::map<std::pair<int, uint32_t>, uint64_t> bankConflictsAt; // (kernel handle, pc) -> BankAccess::conflicts()
+    size_t shared_pc; // pc of the warp issued last
+    SM(int sm_id, DeviceMemory& memory, const GpuConfig& config);
     void addWarp(const Warp& warp);
-    void cycle(const std::vector<Instr>& program);
+    void cycle(uint64_t cycle);
+    int functionalCycle();
+    void commitStores();
+    // Applies this cycle's queued accesses to the shared L2, counting them
+    // unless `count` is false.
+    void drainL2(Cache& l2, bool count = true);
+    // True if a block of `launch` fits in the free warp slots, block slots
+    // and shared memory.
+    bool canHost(const KernelLaunch& launch) const;
+    void startBlock(KernelLaunch& launch, int blockId);
+    // Frees the slots of blocks whose warps have all finished.
+    void releaseBlocks();
+    // Books `cycles` skipped cycles in which no warp could issue.
+    void countSkipped(uint64_t cycles);
+    bool isFinished() const;
 private:
-    void execute(Warp& warp, const Instr& instruction);
+    std::vector<char> ready;
+    std::vector<int> issued;
+    std::vector<int8_t> stallOf; // last cycle's stall reason per warp, -1 if none
+    bool warpFree(const Warp& warp) const;
+    const Program& programOf(const Warp& warp) const { return *blocks[warp.block].launch->program; }
+    MemoryAccess execute(Warp& warp, const DecodedInstr& instruction, const Program& program, uint64_t cycle);
+    MemoryAccess accessMemory(const struct ExecutionContext& ctx, const DecodedInstr& instruction, uint64_t cycle);
+    void warmCaches(const struct ExecutionContext& ctx, const DecodedInstr& instruction);
+    void advance(Warp& warp, const DecodedInstr& instruction, const Program& program, LaneMask mask, LaneMask taken);
+    ErrorCode issue(struct ExecutionContext& ctx, const DecodedInstr& instruction);
+};
+
+// A program registered with GPU::addKernel, translated once for every
+// launch of it.
+struct LoadedKernel {
+    Program program;
+    std::unique_ptr<ThreadedProgram> threaded;
 };
 
 class GPU {
 public:
-    std::vector<float> global_memory;
+    GpuConfig config;
+    DeviceMemory global_memory;
+    DeviceAllocator allocator; // global memory by byte address
+    std::map<DevicePtr, DevicePtr> mappedFiles; // address handed out -> page it is mapped at (files and host buffers)
     std::vector<SM> sms;
     std::vector<std::shared_ptr<Thread>> all_threads;
-    std::vector<Instr> program;
+    Program program;
+    KernelLaunch kernel; // blocks of the launch made with launch() or at construction
+    int nextSm;          // where block dispatch looks first
+    std::vector<std::unique_ptr<LoadedKernel>> kernels; // handle k is kernels[k - 1]
+    std::vector<Stream> streams;                        // 0 is the default stream
+    std::vector<Event> events;
+    std::list<KernelLaunch> streamLaunches;             // reached and not yet finished
     long long cycle_count;
 
+    std::unique_ptr<WorkerPool> pool;
+    std::unique_ptr<ThreadedProgram> threaded;
+    std::unique_ptr<TimingModel> timing;
+    bool timingEnabled;
+    std::unique_ptr<Cache> l2; // shared by the SMs, null unless GpuConfig::caches
+    SchedulerPolicy appliedScheduler;
     std::thread worker;
     std::mutex mtx;
+    std::vector<char> breakpoints; // by pc, guarded by mtx
+    std::mutex paceMtx;
+    std::condition_variable paceCv;
     std::atomic<bool> running{false};
     std::atomic<bool> finished{false};
+    std::atomic<TraceLevel> traceLevel{TraceLevel::Off};
+    std::atomic<Engine> engine{Engine::Handlers};
+    std::atomic<SchedulerPolicy> schedulerPolicy{SchedulerPolicy::LooseRoundRobin};
+    std::atomic<RunMode> runMode{RunMode::Paced};
+    std::atomic<int> paceMs{DELAY_TIME};
+    std::atomic<long long> cycleLimit{0};
+    std::atomic<StopReason> stopReason{StopReason::Stopped};
 
-    GPU(const std::vector<Instr>& program);
+    GPU(const Program& program, const GpuConfig& config = GpuConfig());
+    GPU(const std::vector<Instr>& program, const GpuConfig& config = GpuConfig());
     ~GPU();
 
+    void load(const std::vector<Instr>& program);
+    void load(const Program& program);
+    // Starts `kernel` on a `grid` of blocks of `block` threads, replacing
+    // any launch still running; global memory is kept. Blocks wait in order
+    // and go to SMs round-robin as warp slots and shared memory free up.
+    // Every block gets `shared_bytes` of its own shared memory, or with 0
+    // as much as the kernel's shared operands reach. `params` are read
+    // with %param0, %param1, ... Throws std::invalid_argument if a block
+    // can never fit on an SM, and std::logic_error while streams have work
+    // queued (synchronize() first).
+    void launch(const Program& kernel, Dim3 grid, Dim3 block,
+                const std::vector<double>& params = {}, size_t shared_bytes = 0);
+    void bindProgram();
+    // Frees the slots of finished blocks, moves the streams along and hands
+    // waiting blocks to SMs with room for them; true if any started.
+    bool dispatchBlocks();
+    bool advanceStreams();
+    uint64_t copyWake() const;
+    void beginLaunch(Dim3 grid, Dim3 block, const std::vector<double>& params, size_t sharedWords);
+    void checkLaunch(Dim3 grid, Dim3 block, size_t sharedWords) const;
+    static size_t sharedWordsUsed(const Program& kernel, int blockThreads);
+    DevicePtr mappingRange(const char* what, size_t bytes);
+    void applyScheduler(SchedulerPolicy policy);
+    StopReason runLoop();
+
+    // Runs on a background thread in the current run mode; the mode and
+    // pace may be changed while it runs. Only Paced ever sleeps.
     void run();
+    // Same loop on the calling thread.
+    StopReason runBlocking();
+    // Runs `cycles` more cycles in the background (RunMode::Cycles).
+    void runFor(long long cycles);
+    void setRunMode(RunMode mode);
+    void setPace(int ms);
+    void setCycleLimit(long long cycle) { cycleLimit = cycle; }
+    void addBreakpoint(size_t pc);
+    void removeBreakpoint(size_t pc);
+    void clearBreakpoints();
+    std::vector<size_t> getBreakpoints();
+    // True if an unfinished warp's next instruction is at a breakpoint.
+    bool atBreakpoint();
+
+    // Simulates one cycle on the calling thread; false once every SM is done.
+    // With the timing model on, cycles in which every warp is stalled are
+    // skipped in one step.
+    bool step();
+    // One functional cycle: the scheduler issues with every unfinished warp
+    // treated as ready, without timing, trace or counters. Cache tags are
+    // kept up to date. Returns the number of warp instructions issued.
+    uint64_t stepFunctional();
+    // Turns the timing model on or off between cycles.
+    void setTiming(bool enabled);
+
+    // Device memory (see allocator.hpp). Pointers are byte addresses; pass
+    // them as kernel parameters, keep them in address registers and
+    // dereference them with gm[aN].
+    DevicePtr deviceMalloc(size_t bytes);
+    void deviceFree(DevicePtr ptr);
+    // Freed when the launch after the next one starts (launch() or
+    // launchAsync(), though never while the kernel it was made for is still
+    // queued or running on a stream), or by releaseTemps().
+    DevicePtr deviceMallocTemp(size_t bytes);
+    void releaseTemps();
+    // Host access to the words at `ptr`, for filling inputs and reading results.
+    float* hostPointer(DevicePtr ptr);
+    // Exposes `bytes` of a host file from `offset` (a multiple of 4; 0
+    // bytes = to the end of the file) as global memory without copying it
+    // and returns its address. A WriteBack file is created or extended as
+    // needed. Throws std::runtime_error if the file cannot be mapped or
+    // global memory has no free range that large.
+    DevicePtr mapFile(const std::string& path, MapMode mode, size_t offset = 0, size_t bytes = 0);
+    // The same over a descriptor the caller owns, such as a memfd or shm
+    // object it also maps itself to share a buffer with the kernels.
+    DevicePtr mapDescriptor(int fd, MapMode mode, size_t offset, size_t bytes);
+    // The same over `bytes` of a buffer the caller already has mapped,
+    // without a descriptor: `host` must be page aligned and MAP_SHARED
+    // memory (see DeviceMemory::mapHost), and the host sees kernel stores
+    // as they commit. ReadOnly or WriteBack only; anything else, or
+    // private memory, throws std::invalid_argument. The buffer must stay
+    // mapped until unmap().
+    DevicePtr mapHost(void* host, size_t bytes, MapMode mode);
+    // Flushes a WriteBack mapping; the address range becomes free memory.
+    void unmap(DevicePtr ptr);
+
+    // Streams (see stream.hpp). Enqueueing only queues work; run(),
+    // runBlocking() or one of the synchronize calls execute it, and a
+    // running GPU picks up new work as long as it has not finished.
+    // Stream 0 always exists. Bad handles or ranges throw std::out_of_range.
+    //
+    // Registers a program for launchAsync and returns its handle (>= 1).
+    int addKernel(const Program& program);
+    // The program behind a handle, 0 being GPU::program.
+    const Program& kernelProgram(int kernel) const;
+    int createStream();
+    int createEvent();
+    void launchAsync(int stream, int kernel, Dim3 grid, Dim3 block,
+                     const std::vector<double>& params = {}, size_t shared_bytes = 0);
+    // Copies take count * 4 / GpuConfig::copy_bytes_per_cycle cycles.
+    void copyToDeviceAsync(int stream, size_t deviceWord, const float* src, size_t count);
+    void copyToHostAsync(int stream, float* dst, size_t deviceWord, size_t count);
+    void recordEvent(int event, int stream);
+    // Later work on `stream` waits for the event's latest recording.
+    void waitEvent(int stream, int event);
+    bool eventDone(int event);
+    // Cycle at which the event's latest recording completed.
+    uint64_t eventCycle(int event);
+    bool streamsIdle() const;
+    // Simulate on the calling thread until everything, one stream or one
+    // event is done.
+    void synchronize();
+    void synchronizeStream(int stream);
+    void synchronizeEvent(int event);
+    // True once every launch has run to completion and the streams are empty.
+    bool isFinished() const;
 
     void stop();
 
+    void setTraceLevel(TraceLevel level) { traceLevel = level; }
+    void setEngine(Engine e) { engine = e; }
+    // Takes effect at the next cycle; scheduler state starts fresh.
+    void setScheduler(SchedulerPolicy policy) { schedulerPolicy = policy; }
+    // Complete simulation state (memory, launch and resident blocks,
+    // registers, pcs, SIMT stacks, scoreboards, scheduler state, counters)
+    // as a binary blob. restore()
+    // only accepts a checkpoint of the same program on the same geometry
+    // and returns false otherwise, as it does for a truncated or corrupt
+    // blob (counts past its end, pcs, warp indices, variable offsets or a
+    // launch shape the GPU could not have had); the GPU is only changed
+    // once the whole blob has been read.
+    // Trace buffers are not included.
+    // checkpoint() throws std::logic_error while streams have work queued
+    // or host files or buffers are mapped, and restore() returns false in
+    // both cases rather than overwrite them.
+    std::string checkpoint();
+    bool restore(const std::string& blob);
+    bool restore(const char* data, size_t size);
+    // The file variants write through and read from a memory mapping.
+    bool checkpointToFile(const std::string& path);
+    bool restoreFromFile(const std::string& path);
+
+    // Counters of every warp on the device added up.
+    WarpCounters counterTotals() const;
+    // Bank conflicts of every SM by (kernel handle, pc), for the
+    // instructions that had any.
+    std::map<std::pair<int, uint32_t>, uint64_t> bankConflictsByInstruction() const;
+    // Trace records still held by every SM, oldest first.
+    std::vector<TraceRecord> traceSnapshot() const;
+
     void print_shared_mem() const;
     void print_global_mem() const;
     int get_cycle() const;
+    // Restarts the current launch from cycle 0 with memory cleared. Throws
+    // std::logic_error while streams have work queued.
     void reset();
 };
@@ -3,11 +3,25 @@
 #include <vector>
 #include <variant>
 #include <optional>
+#include <cstdint>
 
 enum class Opcode { ADD, SUB, MUL, DIV, NEG, LD, ST, MOV, HALT, DEF, LABEL, JMP,CMP_LT, AND, OR, XOR };
 enum class StoreLoc { GLOBAL, SHARED, LOCAL };
-enum class ErrorCode { None, GlobalOutOfBounds, SharedOutOfBounds, InvalidMemorySpace, DivByZero, StringReq, VarNotFound};
-enum class OpKind { Constant, Register, Variable, Global, Shared, Invalid };
+enum class ErrorCode { None, GlobalOutOfBounds, SharedOutOfBounds, InvalidMemorySpace, DivByZero, StringReq, VarNotFound, UnknownLabel, ReadOnlyMemory, MisalignedAddress, InexactPointer};
+enum class OpKind { Constant, Register, Global, Shared, Symbol, Special, Param, Address, Invalid };
+
+// Read-only per-thread values of a launch, named like PTX's (%tid.x ...).
+// An OpKind::Special operand's index is one of these; an OpKind::Param
+// operand's index is the kernel parameter number (%param0 ...) and an
+// OpKind::Address operand's the address register number (a0 ...).
+enum class SpecialReg {
+    TidX, TidY, TidZ,         // thread index in the block
+    NtidX, NtidY, NtidZ,      // block shape
+    CtaidX, CtaidY, CtaidZ,   // block index in the grid
+    NctaidX, NctaidY, NctaidZ, // grid shape
+    LaneId, WarpId            // lane in the warp, warp in the block
+};
+constexpr int NUM_SPECIAL_REGS = 14;
 
 struct Variable {
     std::string name;
@@ -23,16 +37,58 @@ using Operand = std::variant<Opcode, std::string, float, Variable, StoreLoc, int
 struct Instr {
     Opcode op;
     std::vector<Operand> src;
+    int width = 1; // words each lane moves in an LD/ST (LD.V2, LD.V4)
 };
 
-struct OpInfo {
+// An operand after load-time decoding. Variables are resolved to the
+// storage they were DEF'd in, so at run time an operand is only a kind
+// and an index (or the thread id when tidx is set).
+// A gm[rN+K] or sm[rN+K] operand instead takes the byte address held in
+// register `base` plus the byte offset K in `index`, which must come to a
+// multiple of 4 (of 4 * width for vector accesses); gm[aN+K] takes it from
+// address register `base`.
+struct DecodedOperand {
     OpKind kind;
-    float constVal;
+    bool tidx;
     int index;
-    Variable var;
+    float constVal;
+    int slot; // variable slot or symbol index, -1 if none
+    int base = -1;
+    bool baseAddress = false; // `base` is an address register
+};
+// A JMP's Symbol operand carries its resolved target pc in `index`
+// (-1 if the label was never defined).
+
+constexpr int MAX_OPERANDS = 3;
+
+struct DecodedInstr {
+    Opcode op;
+    uint8_t width = 1; // see Instr::width
+    int numOperands;
+    DecodedOperand src[MAX_OPERANDS];
+};
+
+struct Program {
+    std::vector<DecodedInstr> code;
+    std::vector<Variable> vars;         // indexed by variable slot
+    std::vector<std::string> symbols;   // label names
+    std::vector<int> labels;            // symbol index -> target pc, -1 if undefined
+    std::vector<int> reconverge;        // pc -> immediate post-dominator, code.size() = exit
 };
 
 // parsing helpers
 int getRegisterName(std::string reg);
 int getMemoryLocation(std::string mem);
-OpInfo decodeOperand(const Operand &op, class Thread &t);
+DecodedOperand decodeOperand(const Operand &op, Program &prog);
+Program compileProgram(const std::vector<Instr> &program);
+void resolveLabels(Program &prog);
+void computeReconvergence(Program &prog);
+
+const char *opcodeName(Opcode op);
+// The opcode as written, with its vector suffix ("LD.V4").
+std::string mnemonic(const DecodedInstr &instr);
+// "%tid.x" etc., or nullptr if out of range.
+const char *specialRegName(int reg);
+// True if src[0] is written rather than read.
+bool writesDestination(Opcode op);
+std::string describeOperand(const DecodedOperand &op, const Program &prog);
@@ -0,0 +1,12 @@
+#pragma once
+#include "instruction.hpp"
+#include <string>
+#include <vector>
+#include <optional>
+
+// Built-in example kernels shared by the GUI and the headless runner.
+std::vector<Instr> loopKernel();
+std::vector<Instr> orKernel();
+
+std::vector<std::string> kernelNames();
+std::optional<std::vector<Instr>> findKernel(const std::string& name);
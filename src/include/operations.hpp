@@ -1,26 +1,26 @@
 #pragma once
 #include "instruction.hpp"
-#include "gpu.hpp"
+#include "execution.hpp"
 #include <array>
 
-using HandlerFn = ErrorCode(*)(Thread&, Warp&, std::vector<float>&, const Instr&);
+using HandlerFn = ErrorCode(*)(ExecutionContext&, const DecodedInstr&);
 extern std::array<HandlerFn, 16> opcode_handlers;
 
 void setup_opcode_handlers();
 
-ErrorCode _add_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _sub_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _mul_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _div_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _neg_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _mov_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _ld_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _st_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _halt_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _def_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _label_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _cond_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _jump_(Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _and_ (Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _or_ (Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
-ErrorCode _xor_ (Thread& t, Warp& warp, std::vector<float>& global, const Instr& instr);
+ErrorCode _add_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _sub_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _mul_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _div_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _neg_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _mov_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _ld_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _st_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _halt_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _def_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _label_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _cond_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _jump_(ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _and_ (ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _or_ (ExecutionContext& ctx, const DecodedInstr& instr);
+ErrorCode _xor_ (ExecutionContext& ctx, const DecodedInstr& instr);
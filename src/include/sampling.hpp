@@ -0,0 +1,46 @@
+#pragma once
+#include "counters.hpp"
+#include <cstdint>
+#include <vector>
+
+class GPU;
+
+// Systematic sampling in units of warp instructions: every `period`
+// instructions, `warmup` run under the timing model to refill the
+// scoreboards and scheduler, then `window` run detailed and measured. The
+// rest of each period is fast-forwarded functionally, with the scheduler
+// still choosing which warps issue so their relative progress matches a
+// detailed run. Cache tags are updated during fast-forward too, so the
+// warm-up only has to refill the timing state.
+struct SamplingConfig {
+    uint64_t period = 100000;
+    uint64_t warmup = 2000;
+    uint64_t window = 10000;
+    // widest 95% confidence interval half-width, as a fraction of the
+    // estimate, that SampleEstimate::confident accepts
+    double tolerance = 0.1;
+};
+
+struct SampleWindow {
+    uint64_t instructions;
+    uint64_t cycles;
+};
+
+struct SampleEstimate {
+    uint64_t instructions = 0;  // exact, whole kernel
+    uint64_t detailedInstructions = 0; // run under the timing model (warm-up included)
+    std::vector<SampleWindow> windows;
+    double cpi = 0;             // mean cycles per warp instruction over the windows
+    double cycles = 0;          // estimated whole-kernel cycles
+    double cyclesLow = 0;       // 95% confidence interval, equal to `cycles`
+    double cyclesHigh = 0;      // when there are fewer than two windows
+    // At least two windows and a confidence interval within the tolerance;
+    // otherwise the estimate should not be trusted.
+    bool confident = false;
+    WarpCounters sampled;       // counted during measurement windows only
+    double scale = 0;           // multiply `sampled` by this for whole-kernel estimates
+};
+
+// Runs the GPU's kernel to completion from its current state. Leaves
+// the timing model as it was configured.
+SampleEstimate runSampled(GPU& gpu, const SamplingConfig& config);
@@ -0,0 +1,65 @@
+#pragma once
+#include "config.hpp"
+#include "binio.hpp"
+#include <vector>
+#include <deque>
+#include <memory>
+
+// Chooses which of an SM's warps issue each cycle. `ready` has one entry
+// per warp; a scheduler appends at most `width` distinct indices of ready
+// warps to `out`, in issue order. Schedulers keep state across cycles and
+// belong to a single SM.
+class WarpScheduler {
+public:
+    virtual ~WarpScheduler() = default;
+    virtual void select(const std::vector<char>& ready, int width, std::vector<int>& out) = 0;
+    // Scheduler state for checkpoints.
+    virtual void save(std::string& out) const = 0;
+    virtual bool load(Reader& in) = 0;
+};
+
+// Loose round-robin: start one past the last warp issued and take the
+// next ready warps in order.
+class LooseRoundRobin : public WarpScheduler {
+public:
+    void select(const std::vector<char>& ready, int width, std::vector<int>& out) override;
+    void save(std::string& out) const override;
+    bool load(Reader& in) override;
+
+private:
+    size_t next = 0;
+};
+
+// Greedy-then-oldest: keep issuing the same warp while it stays ready,
+// then fall back to the oldest ready warps. All warps of an SM launch
+// together, so age order is warp index order.
+class GreedyThenOldest : public WarpScheduler {
+public:
+    void select(const std::vector<char>& ready, int width, std::vector<int>& out) override;
+    void save(std::string& out) const override;
+    bool load(Reader& in) override;
+
+private:
+    int greedy = -1;
+};
+
+// Two-level: round-robin over a small active set; a warp that is not
+// ready is moved to the back of the pending queue and replaced by the
+// first ready pending warp.
+class TwoLevel : public WarpScheduler {
+public:
+    TwoLevel(int num_warps, int active_size);
+    void select(const std::vector<char>& ready, int width, std::vector<int>& out) override;
+    void save(std::string& out) const override;
+    bool load(Reader& in) override;
+
+private:
+    std::vector<int> active;
+    std::deque<int> pending;
+    size_t activeSize;
+    int numWarps;
+    size_t next = 0;
+};
+
+std::unique_ptr<WarpScheduler> makeScheduler(SchedulerPolicy policy, int num_warps, int active_size);
+const char* schedulerName(SchedulerPolicy policy);
@@ -0,0 +1,51 @@
+#pragma once
+#include "config.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct KernelLaunch;
+
+// One piece of work queued on a stream. A stream runs its operations in
+// order, each starting once the one before it has finished; operations on
+// different streams overlap, so kernels from several streams share the SMs.
+struct StreamOp {
+    enum Kind : uint8_t { Kernel, CopyToDevice, CopyToHost, RecordEvent, WaitEvent };
+    Kind kind;
+    // Kernel: which program and how to launch it; `launch` is created when
+    // the operation is reached and lives until its last block finishes.
+    int kernel = 0;
+    Dim3 grid;
+    Dim3 block;
+    size_t sharedWords = 0;
+    KernelLaunch* launch = nullptr;
+    uint64_t temps = 0; // allocator generation of the temporaries made for it
+    std::vector<double> params;
+    // The words a CopyToDevice writes (taken when it is enqueued, so the
+    // caller's buffer may be reused right away).
+    std::vector<float> data;
+    // Copies move `count` words at device word `deviceWord`. A CopyToHost
+    // writes `host` when it completes, which must stay valid until then.
+    size_t deviceWord = 0;
+    float* host = nullptr;
+    size_t count = 0;
+    bool started = false;
+    uint64_t doneAt = 0; // cycle a started copy completes
+    // RecordEvent: the recording this is. WaitEvent: the recording waited
+    // for, the event's latest when the wait was enqueued (0 = none).
+    int event = 0;
+    uint64_t sequence = 0;
+};
+
+struct Stream {
+    std::deque<StreamOp> ops;
+};
+
+// Marks a point in a stream. Every recordEvent() makes a new recording,
+// which completes when its stream reaches it.
+struct Event {
+    uint64_t recorded = 0;  // recordings made
+    uint64_t completed = 0; // latest recording reached
+    uint64_t cycle = 0;     // cycle the latest completed recording was reached
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "operations.hpp"
+#include <vector>
+
+// Alternative engine: the decoded program is translated once more into
+// threaded code, where every instruction carries a dispatch class and
+// whatever its operands let be fixed up front (a specialized ALU or
+// compare handler, the register rows of an LD/ST, a resolved JMP), so
+// issuing it needs no opcode table lookup and no operand-kind switches.
+//
+// The SM issues one instruction per warp per cycle and runs the scheduler,
+// scoreboard, trace and counters in between, so issue() dispatches a single
+// instruction and returns; it does not chain on to the next one the way an
+// interpreter loop would. Instructions whose operands rule out a fast path
+// (and any that would fault) go through opcode_handlers instead.
+class ThreadedProgram {
+public:
+    enum Class : uint8_t { Call, Load, Store, Jump, Nop, Halt };
+
+    struct Op {
+        Class cls;
+        uint8_t width = 1;
+        int reg = -1; // first register an LD writes or an ST reads
+        HandlerFn fn = nullptr;
+    };
+
+    ThreadedProgram() = default;
+    ThreadedProgram(const Program& program, int num_registers);
+
+    ErrorCode issue(ExecutionContext& ctx, size_t pc) const;
+    size_t size() const { return code.size(); }
+
+private:
+    std::vector<Op> code;
+};
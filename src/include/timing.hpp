@@ -0,0 +1,47 @@
+#pragma once
+#include "instruction.hpp"
+#include "config.hpp"
+#include <cstdint>
+
+class Warp;
+
+// What the memory path made of one instruction's global accesses.
+struct MemoryAccess {
+    int replays = 0;        // transactions past the first of each global access
+    int globalLatency = -1; // of its global reads, -1 for TimingConfig::global_latency
+    int bankReplays = 0;    // passes past the first of each shared access (see banks.hpp)
+};
+
+// Scoreboard timing. Instructions still execute functionally when they
+// issue; the model only decides when a warp may issue and when what it
+// writes becomes readable. Each warp tracks the cycle every register (and
+// its predicate) is ready, one ready cycle each for its pending writes to
+// global and shared memory, and the first cycle it may issue again; an
+// instruction waits until its inputs and destination are ready. Memory is
+// scoreboarded per space rather than per address, so an access waits for
+// the warp's last write anywhere in that space; other warps do not wait.
+// Reads from global or shared memory add that space's latency to the
+// result; a store lands after its own result latency. A global
+// access split into several segment transactions (see coalescer.hpp) is
+// replayed once per extra transaction, a shared access with bank conflicts
+// once per extra pass. With caches, global reads take the latency of the
+// level that served them.
+class TimingModel {
+public:
+    explicit TimingModel(const TimingConfig& config);
+
+    // First cycle at which `instr` can issue from `warp`.
+    uint64_t readyAt(const Warp& warp, const DecodedInstr& instr) const;
+    // Books the latencies of `instr`, issued from `warp` at `cycle`.
+    void issue(Warp& warp, const DecodedInstr& instr, uint64_t cycle, const MemoryAccess& access) const;
+    // Cycle the result of `instr` issued at `cycle` is ready.
+    uint64_t resultReady(const DecodedInstr& instr, uint64_t cycle, const MemoryAccess& access) const;
+    // Pushes the result of an issued `instr` back to `until`, for an L2
+    // miss only found at the end of the cycle.
+    void delayResult(Warp& warp, const DecodedInstr& instr, uint64_t until) const;
+
+private:
+    TimingConfig config;
+    int memoryLatency(const DecodedInstr& instr, int globalLatency) const;
+    uint64_t replayCycles(const MemoryAccess& access) const;
+};
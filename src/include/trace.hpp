@@ -0,0 +1,72 @@
+#pragma once
+#include "instruction.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class TraceLevel { Off, Instructions, Operands };
+
+// One issued warp instruction. Operand values are taken from the first
+// active lane: sources before the instruction runs, `result` after.
+struct TraceRecord {
+    uint64_t cycle;
+    uint16_t sm;
+    uint16_t kernel; // handle of the program (GPU::kernelProgram)
+    uint8_t opcode;
+    uint8_t error; // ErrorCode returned by the handler
+    uint32_t warp;
+    uint32_t laneMask;
+    uint32_t pc;
+    uint32_t hasValues;
+    float operands[MAX_OPERANDS];
+    float result;
+};
+
+// Fixed-size ring of trace records written by the single worker that
+// simulates an SM and read by anyone else without locking. When full the
+// oldest records are overwritten. `head` doubles as the sequence counter of
+// a seqlock: slots are copied word by word through relaxed atomics, and a
+// reader re-checks `head` afterwards to drop anything the writer may have
+// been overwriting meanwhile.
+class TraceBuffer {
+public:
+    explicit TraceBuffer(size_t capacity);
+    TraceBuffer(const TraceBuffer& other);
+
+    void push(const TraceRecord& rec)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint32_t words[kWords];
+        std::memcpy(words, &rec, sizeof(rec));
+        // Orders the publish of `h` before the slot stores below, so a reader
+        // that sees any of them also sees head >= h.
+        std::atomic_thread_fence(std::memory_order_release);
+        Slot& slot = ring[h & mask];
+        for (size_t i = 0; i < kWords; i++) slot.words[i].store(words[i], std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+    }
+    // Appends the records still in the ring that were written at or after
+    // sequence number `from`; returns the sequence number to resume at.
+    uint64_t snapshot(std::vector<TraceRecord>& out, uint64_t from = 0) const;
+    uint64_t written() const { return head.load(std::memory_order_acquire); }
+    size_t capacity() const { return size; }
+    void clear() { head.store(0, std::memory_order_release); }
+
+private:
+    static_assert(sizeof(TraceRecord) % sizeof(uint32_t) == 0, "TraceRecord must be whole words");
+    static constexpr size_t kWords = sizeof(TraceRecord) / sizeof(uint32_t);
+    struct Slot {
+        std::atomic<uint32_t> words[kWords];
+    };
+    TraceRecord load(uint64_t seq) const;
+
+    size_t size;
+    std::unique_ptr<Slot[]> ring;
+    uint64_t mask;
+    std::atomic<uint64_t> head{0};
+};
+
+std::string formatTrace(const TraceRecord& rec, const Program& program);
@@ -1,17 +1,14 @@
 #pragma once
 #include "instruction.hpp"
-#include <unordered_map>
+#include "gpu.hpp"
+#include <map>
 
+// Name-keyed view of every defined variable, keyed "name_threadid".
+// The simulator itself uses variable slots only; this table is rebuilt
+// from the slot storage on demand for debugging and the GUI.
 class VarTable {
 public:
-
-    VarTable(const VarTable&) = delete;
-    VarTable& operator=(const VarTable&) = delete;
-    static VarTable& getInstance();
-    void addVar(const Variable& var, int thread_id);
-    std::optional<Variable> getVar(const std::string& name, int thread_id);
-    std::unordered_map<std::string, Variable> table;
-
-private:
-    VarTable() {}
+    void refresh(const GPU& gpu);
+    std::optional<Variable> getVar(const std::string& name, int thread_id) const;
+    std::map<std::string, Variable> table;
 };
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+
+// Fixed set of host workers with one task deque each. parallel_for
+// deals tasks round-robin onto the deques; a worker drains its own deque
+// from the front and steals from the back of the others once it is empty.
+// The calling thread takes part as worker 0, so a pool of size 1 runs
+// everything inline.
+class WorkerPool {
+public:
+    explicit WorkerPool(int num_workers);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs fn(i) for every i in [0, count) and returns when all are done.
+    void parallel_for(int count, const std::function<void(int)>& fn);
+    int size() const { return static_cast<int>(queues.size()); }
+
+private:
+    struct Queue {
+        std::mutex mtx;
+        std::deque<int> tasks;
+    };
+
+    void workerLoop(int self);
+    bool runOne(int self);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    const std::function<void(int)>* job = nullptr;
+    std::atomic<int> remaining{0};
+    std::atomic<unsigned long> generation{0};
+    std::atomic<bool> stopping{false};
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::exception_ptr error;
+};
@@ -1,9 +1,11 @@
 #include "instruction.hpp"
-#include "vartable.hpp"
-#include "gpu.hpp"
+#include "config.hpp"
 #include <iostream>
 #include <cctype>
 #include <stdexcept>
+#include <algorithm>
+#include <charconv>
+#include <sstream>
 
 int getRegisterName(std::string _register)
 {
@@ -40,47 +42,362 @@ int getMemoryLocation(std::string mem){
         return -2;
     }
 }
-OpInfo decodeOperand(const Operand &op, Thread &t) {
+static int findVar(const Program &prog, const std::string &name)
+{
+    for (size_t i = 0; i < prog.vars.size(); i++) {
+        if (prog.vars[i].name == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+static int internSymbol(Program &prog, const std::string &name)
+{
+    for (size_t i = 0; i < prog.symbols.size(); i++) {
+        if (prog.symbols[i] == name) return static_cast<int>(i);
+    }
+    prog.symbols.push_back(name);
+    return static_cast<int>(prog.symbols.size() - 1);
+}
+
+static bool allDigits(const std::string &s)
+{
+    return !s.empty() && std::all_of(s.begin(), s.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); });
+}
+
+// A non-negative decimal that fits in an int; false for anything longer.
+static bool parseIndex(const std::string &s, int &out)
+{
+    const char *end = s.data() + s.size();
+    auto [p, ec] = std::from_chars(s.data(), end, out);
+    return allDigits(s) && ec == std::errc() && p == end;
+}
+
+static OpKind kindOf(StoreLoc loc)
+{
+    switch (loc) {
+        case StoreLoc::GLOBAL: return OpKind::Global;
+        case StoreLoc::SHARED: return OpKind::Shared;
+        case StoreLoc::LOCAL: return OpKind::Register;
+    }
+    return OpKind::Invalid;
+}
+
+static DecodedOperand fromVariable(const Variable &v, int slot)
+{
+    return { kindOf(v.loc), v.threadIDX, v.threadIDX ? 0 : v.offset, v.value, slot };
+}
+
+DecodedOperand decodeOperand(const Operand &op, Program &prog) {
     if (auto pf = std::get_if<float>(&op)) {
-        return { OpKind::Constant, *pf,      0,    {} };
+        return { OpKind::Constant, false, 0, *pf, -1 };
+    }
+    if (auto pi = std::get_if<int>(&op)) {
+        return { OpKind::Constant, false, *pi, static_cast<float>(*pi), -1 };
+    }
+    if (auto pv = std::get_if<Variable>(&op)) {
+        return fromVariable(*pv, findVar(prog, pv->name));
     }
 
     if (auto ps = std::get_if<std::string>(&op)) {
-        int tid=t.id();
         const std::string &s = *ps;
+        if (!s.empty() && s[0] == '%') {
+            for (int r = 0; r < NUM_SPECIAL_REGS; r++) {
+                if (s == specialRegName(r)) return {OpKind::Special, false, r, 0.0f, -1};
+            }
+            int param;
+            if (s.compare(0, 6, "%param") == 0 && parseIndex(s.substr(6), param)) {
+                return {OpKind::Param, false, param, 0.0f, -1};
+            }
+        }
+        // address register? (aN, no TIDX form)
+        else if (s.size()>1 && s[0]=='a' && allDigits(s.substr(1))) {
+            int r = getRegisterName(s);
+            if (r >= 0) return {OpKind::Address, false, r, 0.0f, -1};
+        }
         // register?
-        if (s.size()>1 && s[0]=='r') {
+        else if (s.size()>1 && s[0]=='r') {
             int r = getRegisterName(s);
-            if(r==0){
-                return {OpKind::Register, 0.0f, r, {}};
-            }else if(r==-1){
-                return {OpKind::Register, 0.0f, tid, {}};
-            }else if(r >= 0 && r < NUM_REGISTERS){
-                return {OpKind::Register, 0.0f, r, {}};
+            if(r==TIDX_RETURN_VAL){
+                return {OpKind::Register, true, 0, 0.0f, -1};
+            }else if(r >= 0){
+                return {OpKind::Register, false, r, 0.0f, -1};
             }
-        }else if(s.size()>1 && s.substr(0,2) == "gm" ){
-            int g = getMemoryLocation(s) ;
-            if(g==0){
-                return {OpKind::Global, 0.0f, g, {}};
-            }else if(g==-1){
-                return {OpKind::Global, 0.0f, tid, {}};
+        }else if(s.size()>4 && (s.compare(0, 3, "gm[") == 0 || s.compare(0, 3, "sm[") == 0) && s.back() == ']'){
+            // gm[rN], gm[rN+K], gm[rN-K]: byte address in a register plus a
+            // byte offset; gm[aN+K] takes it from an address register
+            std::string inner = s.substr(3, s.size() - 4);
+            size_t sign = inner.find_first_of("+-");
+            int offset = 0;
+            bool ok = true;
+            if (sign != std::string::npos) {
+                ok = parseIndex(inner.substr(sign + 1), offset);
+                if (inner[sign] == '-') offset = -offset;
+                inner.erase(sign);
             }
-        }else if(s.size()>1 && s.substr(0,2) == "sm" ){
-           const int f = getMemoryLocation(s);
-            if(f==0){
-                return {OpKind::Shared, 0.0f, f, {}};
-            }else if(f==-1){
-                return {OpKind::Shared, 0.0f, tid, {}};
+            const bool address = inner.size() > 1 && inner[0] == 'a';
+            ok = ok && (address || inner[0] == 'r') && allDigits(inner.substr(1));
+            int r = ok ? getRegisterName(inner) : -2;
+            if(r >= 0){
+                DecodedOperand d{s[0] == 'g' ? OpKind::Global : OpKind::Shared, false, offset, 0.0f, -1};
+                d.base = r;
+                d.baseAddress = address;
+                return d;
+            }
+        }else if(s.size()>2 && s.substr(0,2) == "gm" ){
+            int g = getMemoryLocation(s);
+            if(g==TIDX_RETURN_VAL){
+                return {OpKind::Global, true, 0, 0.0f, -1};
+            }else if(g >= 0){
+                return {OpKind::Global, false, g, 0.0f, -1};
+            }
+        }else if(s.size()>2 && s.substr(0,2) == "sm" ){
+            int f = getMemoryLocation(s);
+            if(f==TIDX_RETURN_VAL){
+                return {OpKind::Shared, true, 0, 0.0f, -1};
+            }else if(f >= 0){
+                return {OpKind::Shared, false, f, 0.0f, -1};
             }
         }
         // otherwise, variable lookup
-        if (auto ov = VarTable::getInstance().getVar(s, t.id())) {
-            Variable v = *ov;
-            int addr = v.offset;
-            float val = v.value;
-            return { OpKind::Variable, val, addr, std::move(v) };
+        int slot = findVar(prog, s);
+        if (slot >= 0) {
+            return fromVariable(prog.vars[slot], slot);
+        }
+        std::cerr << "ERROR decoding operand: unknown name " << s << "\n";
+    }
+
+    return { OpKind::Invalid, false, -1, 0.0f, -1 };
+}
+
+Program compileProgram(const std::vector<Instr> &program)
+{
+    Program prog;
+
+    // Variables may be referenced before the DEF that creates them is
+    // reached, so collect every DEF up front.
+    for (const auto &instr : program) {
+        if (instr.op != Opcode::DEF || instr.src.empty()) continue;
+        if (auto pv = std::get_if<Variable>(&instr.src[0])) {
+            int slot = findVar(prog, pv->name);
+            if (slot < 0) {
+                prog.vars.push_back(*pv);
+            } else if (prog.vars[slot].loc != pv->loc) {
+                std::cerr << "WARNING: variable " << pv->name << " redefined in a different location\n";
+            }
+        }
+    }
+
+    prog.code.reserve(program.size());
+    for (const auto &instr : program) {
+        DecodedInstr d{};
+        d.op = instr.op;
+        // only the widths LD/ST have; anything else moves one word
+        d.width = static_cast<uint8_t>(instr.width == 2 || instr.width == 4 ? instr.width : 1);
+        d.numOperands = static_cast<int>(std::min<size_t>(instr.src.size(), MAX_OPERANDS));
+        for (int i = 0; i < d.numOperands; i++) {
+            const Operand &op = instr.src[i];
+            const std::string *name = std::get_if<std::string>(&op);
+            if (i == 0 && name && (instr.op == Opcode::LABEL || instr.op == Opcode::JMP)) {
+                d.src[i] = { OpKind::Symbol, false, 0, 0.0f, internSymbol(prog, *name) };
+            } else {
+                d.src[i] = decodeOperand(op, prog);
+            }
+        }
+        prog.code.push_back(d);
+    }
+
+    resolveLabels(prog);
+    computeReconvergence(prog);
+    return prog;
+}
+
+// Binds every JMP to an absolute pc once, so branches never search for
+// their label at run time and may jump forward to a label not yet reached.
+void resolveLabels(Program &prog)
+{
+    prog.labels.assign(prog.symbols.size(), -1);
+    for (size_t pc = 0; pc < prog.code.size(); pc++) {
+        const DecodedInstr &d = prog.code[pc];
+        if (d.op != Opcode::LABEL || d.numOperands < 1 || d.src[0].kind != OpKind::Symbol) continue;
+        // an explicit position wins; a bare label marks its own pc
+        int target = d.numOperands > 1 && d.src[1].kind == OpKind::Constant ? d.src[1].index
+                                                                           : static_cast<int>(pc);
+        int &label = prog.labels[d.src[0].slot];
+        if (label >= 0) {
+            std::cerr << "WARNING: label " << prog.symbols[d.src[0].slot] << " defined twice, keeping the first\n";
+            continue;
+        }
+        label = target;
+    }
+
+    for (auto &d : prog.code) {
+        if (d.op != Opcode::JMP || d.numOperands < 1 || d.src[0].kind != OpKind::Symbol) continue;
+        d.src[0].index = prog.labels[d.src[0].slot];
+        if (d.src[0].index < 0)
+            std::cerr << "ERROR: jump to undefined label " << prog.symbols[d.src[0].slot] << "\n";
+    }
+}
+
+// Immediate post-dominator of every pc, which is where the lanes of a
+// divergent JMP meet again. Uses the Cooper/Harvey/Kennedy iteration on
+// the reversed control flow graph; node code.size() is the exit, reached
+// by HALT or by running off the end. Code that never reaches the exit
+// (an endless loop) gets the exit, i.e. no reconvergence.
+void computeReconvergence(Program &prog)
+{
+    const int n = static_cast<int>(prog.code.size());
+    const int exitNode = n;
+    auto successors = [&](int pc, int out[2]) {
+        const DecodedInstr &d = prog.code[pc];
+        if (d.op == Opcode::HALT) {
+            out[0] = exitNode;
+            return 1;
+        }
+        int count = 0;
+        out[count++] = pc + 1;
+        if (d.op == Opcode::JMP && d.src[0].index >= 0 && d.src[0].index != pc + 1)
+            out[count++] = std::min(d.src[0].index, exitNode);
+        return count;
+    };
+
+    std::vector<std::vector<int>> preds(n + 1);
+    for (int pc = 0; pc < n; pc++) {
+        int succ[2];
+        int count = successors(pc, succ);
+        for (int i = 0; i < count; i++) preds[succ[i]].push_back(pc);
+    }
+
+    // postorder of the reversed graph, walked from the exit
+    std::vector<int> order(n + 1, -1);
+    std::vector<int> postorder;
+    std::vector<std::pair<int, size_t>> stack{{exitNode, 0}};
+    std::vector<bool> seen(n + 1, false);
+    seen[exitNode] = true;
+    while (!stack.empty()) {
+        auto &[node, next] = stack.back();
+        if (next < preds[node].size()) {
+            int p = preds[node][next++];
+            if (!seen[p]) {
+                seen[p] = true;
+                stack.push_back({p, 0});
+            }
+            continue;
         }
+        order[node] = static_cast<int>(postorder.size());
+        postorder.push_back(node);
+        stack.pop_back();
     }
 
-    return { OpKind::Invalid, 0.0f, -1, {} };
+    std::vector<int> ipdom(n + 1, -1);
+    ipdom[exitNode] = exitNode;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (order[a] < order[b]) a = ipdom[a];
+            while (order[b] < order[a]) b = ipdom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+            int node = *it;
+            if (node == exitNode) continue;
+            int succ[2];
+            int count = successors(node, succ);
+            int best = -1;
+            for (int i = 0; i < count; i++) {
+                if (ipdom[succ[i]] < 0) continue;
+                best = best < 0 ? succ[i] : intersect(succ[i], best);
+            }
+            if (best != ipdom[node]) {
+                ipdom[node] = best;
+                changed = true;
+            }
+        }
+    }
+
+    prog.reconverge.assign(n, exitNode);
+    for (int pc = 0; pc < n; pc++) {
+        if (ipdom[pc] >= 0) prog.reconverge[pc] = ipdom[pc];
+    }
+}
+
+const char *opcodeName(Opcode op)
+{
+    switch (op) {
+        case Opcode::ADD: return "ADD";
+        case Opcode::SUB: return "SUB";
+        case Opcode::MUL: return "MUL";
+        case Opcode::DIV: return "DIV";
+        case Opcode::NEG: return "NEG";
+        case Opcode::LD: return "LD";
+        case Opcode::ST: return "ST";
+        case Opcode::MOV: return "MOV";
+        case Opcode::HALT: return "HALT";
+        case Opcode::DEF: return "DEF";
+        case Opcode::LABEL: return "LABEL";
+        case Opcode::JMP: return "JMP";
+        case Opcode::CMP_LT: return "CMP_LT";
+        case Opcode::AND: return "AND";
+        case Opcode::OR: return "OR";
+        case Opcode::XOR: return "XOR";
+    }
+    return "?";
+}
+
+std::string mnemonic(const DecodedInstr &instr)
+{
+    std::string name = opcodeName(instr.op);
+    if (instr.width > 1) name += ".V" + std::to_string(instr.width);
+    return name;
+}
+
+const char *specialRegName(int reg)
+{
+    static const char *const names[NUM_SPECIAL_REGS] = {
+        "%tid.x", "%tid.y", "%tid.z", "%ntid.x", "%ntid.y", "%ntid.z",
+        "%ctaid.x", "%ctaid.y", "%ctaid.z", "%nctaid.x", "%nctaid.y", "%nctaid.z",
+        "%laneid", "%warpid",
+    };
+    return reg >= 0 && reg < NUM_SPECIAL_REGS ? names[reg] : nullptr;
+}
+
+bool writesDestination(Opcode op)
+{
+    switch (op) {
+        case Opcode::ST: case Opcode::HALT: case Opcode::LABEL:
+        case Opcode::JMP: case Opcode::CMP_LT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+std::string describeOperand(const DecodedOperand &op, const Program &prog)
+{
+    if (op.kind == OpKind::Symbol)
+        return prog.symbols[op.slot];
+    if (op.slot >= 0)
+        return prog.vars[op.slot].name;
+    if (op.kind == OpKind::Constant) {
+        std::ostringstream val;
+        val << op.constVal;
+        return val.str();
+    }
+    if (op.kind == OpKind::Invalid)
+        return "<invalid>";
+    if (op.kind == OpKind::Special)
+        return specialRegName(op.index);
+    if (op.kind == OpKind::Param)
+        return "%param" + std::to_string(op.index);
+    const char *space = op.kind == OpKind::Global   ? "gm"
+                        : op.kind == OpKind::Shared  ? "sm"
+                        : op.kind == OpKind::Address ? "a"
+                                                     : "r";
+    if (op.base >= 0) {
+        std::string addr = std::string(space) + (op.baseAddress ? "[a" : "[r") + std::to_string(op.base);
+        if (op.index) addr += (op.index > 0 ? "+" : "") + std::to_string(op.index);
+        return addr + "]";
+    }
+    return space + (op.tidx ? std::string("TIDX") : std::to_string(op.index));
 }
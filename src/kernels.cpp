@@ -0,0 +1,41 @@
+#include "kernels.hpp"
+
+std::vector<Instr> loopKernel()
+{
+    return {
+        // Define registers
+
+        // END x = 30
+        {Opcode::ADD, {"r0", "r0", 1.0f}},
+        {Opcode::DEF, {Variable{"x", 0.0f, 0, false, true, StoreLoc::SHARED}}},
+        {Opcode::DEF, {Variable{"i", 0.0f, 0, false, true, StoreLoc::GLOBAL}}},
+        {Opcode::DEF, {Variable{"z", 10.0f, 2, false, false, StoreLoc::LOCAL}}},
+        {Opcode::LABEL, {"LOOP", 4}},
+        {Opcode::MUL, {"r0", "r0", 3.0f}},
+        {Opcode::ADD, {"i", "i", 1.0f}},
+        {Opcode::CMP_LT, {"i", "z"}},
+        {Opcode::JMP, {"LOOP"}},
+        {Opcode::HALT, {}}};
+}
+
+std::vector<Instr> orKernel()
+{
+    return {
+        {Opcode::DEF, {Variable{"p", 7.0f, 0, false, true, StoreLoc::SHARED}}},
+        {Opcode::DEF, {Variable{"i", 4.0f, 0, false, true, StoreLoc::GLOBAL}}},
+        {Opcode::OR, {"r1", "p", "i"}},
+        {Opcode::HALT, {}}
+    };
+}
+
+std::vector<std::string> kernelNames()
+{
+    return {"loop", "or"};
+}
+
+std::optional<std::vector<Instr>> findKernel(const std::string& name)
+{
+    if (name == "loop") return loopKernel();
+    if (name == "or") return orKernel();
+    return std::nullopt;
+}
@@ -2,6 +2,7 @@
 #include "operations.hpp"
 #include "gui.hpp"
 #include "vartable.hpp"
+#include "kernels.hpp"
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -39,28 +40,15 @@ int main()
 {
     setup_opcode_handlers();
 
-    std::vector<Instr> program = {
-        // Define registers
-
-        // END x = 30
-        {Opcode::ADD, {"r0", "r0", 1.0f}},
-        {Opcode::DEF, {Variable{"x", 0.0f, 0, false, true, StoreLoc::SHARED}}},
-        {Opcode::DEF, {Variable{"i", 0.0f, 0, false, true, StoreLoc::GLOBAL}}},
-        {Opcode::DEF, {Variable{"z", 10.0f, 2, false, false, StoreLoc::LOCAL}}},
-        {Opcode::LABEL, {"LOOP", 4}},
-        {Opcode::MUL, {"r0", "r0", 3.0f}},
-        {Opcode::ADD, {"i", "i", 1.0f}},
-        {Opcode::CMP_LT, {"i", "z"}},
-        {Opcode::JMP, {"LOOP"}},
-        {Opcode::HALT, {}}};
-
-    std::vector<Instr> program2 = {
-        {Opcode::DEF, {Variable{"p", 7.0f, 0, false, true, StoreLoc::SHARED}}},
-        {Opcode::DEF, {Variable{"i", 4.0f, 0, false, true, StoreLoc::GLOBAL}}},
-        {Opcode::OR, {"r1", "p", "i"}},
-        {Opcode::HALT, {}}
-    };
-    GPU gpu(program2);
+    std::vector<Instr> program = loopKernel();
+    std::vector<Instr> program2 = orKernel();
+    GpuConfig config;
+    config.warp_size = 10;
+    config.global_mem_bytes = 10 * sizeof(float);
+    config.shared_mem_bytes = 10 * sizeof(float);
+    GPU gpu(program2, config);
+    VarTable varTable;
+    gpu.setTraceLevel(TraceLevel::Operands);
 
     /*
 
@@ -73,6 +61,8 @@ int main()
     bool logs = true;
     bool simRunning = false;
     bool vars = false;
+    int runCycles = 100;
+    int breakpointPc = 0;
     while (!gui.shouldClose())
     {
         gui.beginFrame();
@@ -111,7 +101,8 @@ int main()
                 ImGui::TableSetupColumn("Name");
                 ImGui::TableSetupColumn("Value");
                 ImGui::TableHeadersRow();
-                const auto &table = VarTable::getInstance().table;
+                varTable.refresh(gpu);
+                const auto &table = varTable.table;
                 for (const auto &pair : table)
                 {
                     ImGui::TableNextRow();
@@ -132,26 +123,38 @@ int main()
             ImGui::SetNextWindowSize(ImVec2(360, 450), ImGuiCond_Once);
 
             ImGui::Begin("Thread Viewer", &threadView);
-            for (auto &thread : gpu.all_threads)
+            for (auto &warp : gpu.sms[0].warps)
             {
-                ImGui::SeparatorText(("Thread " + std::to_string(thread->id())).c_str());
-
-                if (ImGui::BeginTable(("Registers##" + std::to_string(thread->id())).c_str(), 2,
-                                      ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+                for (int lane = 0; lane < warp.size(); lane++)
                 {
-                    ImGui::TableSetupColumn("Register");
-                    ImGui::TableSetupColumn("Value");
-                    ImGui::TableHeadersRow();
+                    const auto &thread = warp.threads[lane];
+                    ImGui::SeparatorText(("Thread " + std::to_string(thread->id())).c_str());
 
-                    for (int j = 0; j < thread->_registers.size(); j++)
+                    if (ImGui::BeginTable(("Registers##" + std::to_string(thread->id())).c_str(), 2,
+                                          ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
                     {
-                        ImGui::TableNextRow();
-                        ImGui::TableSetColumnIndex(0);
-                        ImGui::Text("R%d", j);
-                        ImGui::TableSetColumnIndex(1);
-                        ImGui::Text("%.6f", thread->_registers[j]);
+                        ImGui::TableSetupColumn("Register");
+                        ImGui::TableSetupColumn("Value");
+                        ImGui::TableHeadersRow();
+
+                        for (int j = 0; j < warp.num_registers; j++)
+                        {
+                            ImGui::TableNextRow();
+                            ImGui::TableSetColumnIndex(0);
+                            ImGui::Text("R%d", j);
+                            ImGui::TableSetColumnIndex(1);
+                            ImGui::Text("%.6f", warp.reg(j)[lane]);
+                        }
+                        for (int j = 0; j < warp.num_address_registers; j++)
+                        {
+                            ImGui::TableNextRow();
+                            ImGui::TableSetColumnIndex(0);
+                            ImGui::Text("A%d", j);
+                            ImGui::TableSetColumnIndex(1);
+                            ImGui::Text("%lld", static_cast<long long>(warp.addr(j)[lane]));
+                        }
+                        ImGui::EndTable();
                     }
-                    ImGui::EndTable();
                 }
             }
             ImGui::End();
@@ -183,25 +186,29 @@ int main()
                 }
             }
 
-            if (ImGui::CollapsingHeader("Warp Memory", ImGuiTreeNodeFlags_DefaultOpen))
+            if (ImGui::CollapsingHeader("Shared Memory", ImGuiTreeNodeFlags_DefaultOpen))
             {
-                for (size_t w = 0; w < gpu.sms[0].warps.size(); w++)
+                for (size_t b = 0; b < gpu.sms[0].blocks.size(); b++)
                 {
-                    ImGui::SeparatorText(("Warp " + std::to_string(w)).c_str());
-                    if (ImGui::BeginTable(("WarpTable" + std::to_string(w)).c_str(), 2,
+                    const Block &block = gpu.sms[0].blocks[b];
+                    if (block.memory.empty())
+                        continue;
+                    ImGui::SeparatorText(block.id >= 0 ? ("Block " + std::to_string(block.id)).c_str()
+                                                       : ("Slot " + std::to_string(b) + " (done)").c_str());
+                    if (ImGui::BeginTable(("BlockTable" + std::to_string(b)).c_str(), 2,
                                           ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
                     {
                         ImGui::TableSetupColumn("Address");
                         ImGui::TableSetupColumn("Value");
                         ImGui::TableHeadersRow();
 
-                        for (size_t addr = 0; addr < gpu.sms[0].warps[w].memory.size(); addr++)
+                        for (size_t addr = 0; addr < block.memory.size(); addr++)
                         {
                             ImGui::TableNextRow();
                             ImGui::TableSetColumnIndex(0);
                             ImGui::Text("0x%04zx", addr);
                             ImGui::TableSetColumnIndex(1);
-                            ImGui::Text("%f", gpu.sms[0].warps[w].memory[addr]);
+                            ImGui::Text("%f", block.memory[addr]);
                         }
                         ImGui::EndTable();
                     }
@@ -217,11 +224,31 @@ int main()
             ImGui::SetNextWindowSize(ImVec2(860, 200), ImGuiCond_Once);
 
             ImGui::Begin("Logs", &logs);
+            int level = static_cast<int>(gpu.traceLevel.load());
+            ImGui::Text("Trace:");
+            ImGui::SameLine();
+            ImGui::RadioButton("Off", &level, static_cast<int>(TraceLevel::Off));
+            ImGui::SameLine();
+            ImGui::RadioButton("Instructions", &level, static_cast<int>(TraceLevel::Instructions));
+            ImGui::SameLine();
+            ImGui::RadioButton("Operands", &level, static_cast<int>(TraceLevel::Operands));
+            gpu.setTraceLevel(static_cast<TraceLevel>(level));
             {
                 std::lock_guard<std::mutex> lock(consoleCapture.mtx);
                 ImGui::BeginChild("ScrollingRegion", ImVec2(0, 0), true, ImGuiWindowFlags_HorizontalScrollbar);
                 ImGui::TextUnformatted(consoleCapture.log.c_str());
 
+                // Only the rows on screen get formatted.
+                std::vector<TraceRecord> records = gpu.traceSnapshot();
+                ImGuiListClipper clipper;
+                clipper.Begin(static_cast<int>(records.size()));
+                while (clipper.Step())
+                {
+                    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
+                        ImGui::TextUnformatted(formatTrace(records[i], gpu.kernelProgram(records[i].kernel)).c_str());
+                }
+                clipper.End();
+
                 if (ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
                     ImGui::SetScrollHereY(1.0f);
 
@@ -245,12 +272,57 @@ int main()
                 if (ImGui::Button("reset"))
                 {
                     gpu.reset();
-                    gpu.program = program;
+                    gpu.load(program);
                 }
                 if(ImGui::Button("stop"))
                 {
                     gpu.stop();
                 }
+                ImGui::SameLine();
+                if (ImGui::Button("step") && !gpu.running)
+                {
+                    gpu.step();
+                }
+
+                ImGui::SeparatorText("Run mode");
+                int mode = static_cast<int>(gpu.runMode.load());
+                ImGui::RadioButton("Paced", &mode, static_cast<int>(RunMode::Paced));
+                ImGui::SameLine();
+                ImGui::RadioButton("Free run", &mode, static_cast<int>(RunMode::FreeRun));
+                ImGui::RadioButton("N cycles", &mode, static_cast<int>(RunMode::Cycles));
+                ImGui::SameLine();
+                ImGui::RadioButton("Breakpoint", &mode, static_cast<int>(RunMode::Breakpoint));
+                if (mode != static_cast<int>(gpu.runMode.load()))
+                {
+                    if (mode == static_cast<int>(RunMode::Cycles))
+                        gpu.setCycleLimit(gpu.get_cycle() + runCycles);
+                    gpu.setRunMode(static_cast<RunMode>(mode));
+                }
+
+                int pace = gpu.paceMs;
+                if (ImGui::SliderInt("pace (ms)", &pace, 0, 500))
+                    gpu.setPace(pace);
+                ImGui::InputInt("cycles", &runCycles);
+                if (ImGui::Button("run N cycles") && runCycles > 0)
+                {
+                    gpu.runFor(runCycles);
+                }
+
+                ImGui::InputInt("pc", &breakpointPc);
+                ImGui::SameLine();
+                if (ImGui::Button("break") && breakpointPc >= 0)
+                {
+                    gpu.addBreakpoint(static_cast<size_t>(breakpointPc));
+                }
+                for (size_t pc : gpu.getBreakpoints())
+                {
+                    ImGui::PushID(static_cast<int>(pc));
+                    ImGui::Text("break at %zu", pc);
+                    ImGui::SameLine();
+                    if (ImGui::Button("remove"))
+                        gpu.removeBreakpoint(pc);
+                    ImGui::PopID();
+                }
 
                 ImGui::EndTabItem();
             }
@@ -1,12 +1,13 @@
 #include "operations.hpp"
 #include "execution.hpp"
-#include "vartable.hpp"
-#include "labeltable.hpp"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <mutex>
 std::array<HandlerFn, 16> opcode_handlers;
 
-void setup_opcode_handlers()
+static void fill_opcode_handlers()
 {
     opcode_handlers[static_cast<int>(Opcode::ADD)] = _add_;
     opcode_handlers[static_cast<int>(Opcode::SUB)] = _sub_;
@@ -27,509 +28,348 @@ void setup_opcode_handlers()
 
 }
 
-ErrorCode _add_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+// Safe to call from every GPU constructor, on any thread.
+void setup_opcode_handlers()
 {
-    ExecutionContext ctx{t, warp, global};
-    OpInfo dst = decodeOperand(instr.src[0], t);
-    OpInfo lhs = decodeOperand(instr.src[1], t);
-    OpInfo rhs = decodeOperand(instr.src[2], t);
-
-    float result = eval(lhs, rhs, Opcode::ADD, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-    auto printOperand = [&](const OpInfo &op) -> std::string
-    {
-        if (op.kind == OpKind::Register)
-            return "r" + std::to_string(op.index);
-        return std::to_string(fetch(op, ctx));
-    };
-
-    std::cout << "\n[T" << t.id() << "] ADD "
-              << printOperand(lhs) << " + "
-              << printOperand(rhs) << " -> "
-              << (dst.kind == OpKind::Register ? "r" + std::to_string(dst.index) : dst.var.name)
-              << "\n";
-
-    return ErrorCode::None;
+    static std::once_flag once;
+    std::call_once(once, fill_opcode_handlers);
 }
-ErrorCode _sub_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
-{
-    ExecutionContext ctx{t, warp, global};
-    OpInfo dst = decodeOperand(instr.src[0], t);
-    OpInfo lhs = decodeOperand(instr.src[1], t);
-    OpInfo rhs = decodeOperand(instr.src[2], t);
-
-    float result = eval(lhs, rhs, Opcode::SUB, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-    auto printOperand = [&](const OpInfo &op) -> std::string
-    {
-        if (op.kind == OpKind::Register)
-            return "r" + std::to_string(op.index);
-        return std::to_string(fetch(op, ctx));
-    };
-
-    std::cout << "\n[T" << t.id() << "] SUB "
-              << printOperand(lhs) << " - "
-              << printOperand(rhs) << " -> "
-              << (dst.kind == OpKind::Register ? "r" + std::to_string(dst.index) : dst.var.name)
-              << "\n";
 
+static int toInt(float v) { return static_cast<int>(v); }
+static int64_t toInt(double v) { return static_cast<int64_t>(v); }
+
+// True for whole numbers a double holds exactly, which every device
+// address is.
+static bool exactWhole(double v) { return std::fabs(v) < 9007199254740992.0 && v == std::trunc(v); }
+
+// Pointer arithmetic into an address register: the operands are read
+// exactly and `f` runs on doubles. Every active lane's result has to be
+// exact and whole, or nothing is written.
+template <typename F>
+static ErrorCode addressOp(ExecutionContext &ctx, const DecodedOperand &dst,
+                           const DecodedOperand &lhs, const DecodedOperand &rhs, F f)
+{
+    if (dst.index < 0 || dst.index >= ctx.warp.num_address_registers) return ErrorCode::InvalidMemorySpace;
+    int64_t result[MAX_WARP_SIZE];
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        const double a = fetchWide(lhs, ctx, lane);
+        const double b = fetchWide(rhs, ctx, lane);
+        if (!exactWhole(a) || !exactWhole(b)) return ErrorCode::InexactPointer;
+        const double r = f(a, b);
+        if (!exactWhole(r)) return ErrorCode::InexactPointer;
+        result[lane] = static_cast<int64_t>(r);
+    }
+    int64_t *row = ctx.warp.addr(dst.index);
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane)) row[lane] = result[lane];
+    }
     return ErrorCode::None;
 }
-ErrorCode _mul_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
-{
-    ExecutionContext ctx{t, warp, global};
-    OpInfo dst = decodeOperand(instr.src[0], t);
-    OpInfo lhs = decodeOperand(instr.src[1], t);
-    OpInfo rhs = decodeOperand(instr.src[2], t);
-
-    float result = eval(lhs, rhs, Opcode::MUL, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-    auto printOperand = [&](const OpInfo &op) -> std::string
-    {
-        if (op.kind == OpKind::Register)
-            return "r" + std::to_string(op.index);
-        return std::to_string(fetch(op, ctx));
-    };
-
-    std::cout << "\n[T" << t.id() << "] MUL "
-              << printOperand(lhs) << " * "
-              << printOperand(rhs) << " -> "
-              << (dst.kind == OpKind::Register ? "r" + std::to_string(dst.index) : dst.var.name)
-              << "\n";
 
-    return ErrorCode::None;
+// Runs `f` over every lane of the warp as a single loop over the
+// contiguous lane arrays, then writes back only the active lanes.
+template <typename F>
+static ErrorCode laneOp(ExecutionContext &ctx, const DecodedOperand &dst,
+                        const DecodedOperand &lhs, const DecodedOperand &rhs, F f)
+{
+    if (dst.kind == OpKind::Address) return addressOp(ctx, dst, lhs, rhs, f);
+    alignas(64) float lhsScratch[MAX_WARP_SIZE];
+    alignas(64) float rhsScratch[MAX_WARP_SIZE];
+    alignas(64) float result[MAX_WARP_SIZE];
+    const float *a = fetchLanes(lhs, ctx, lhsScratch);
+    const float *b = fetchLanes(rhs, ctx, rhsScratch);
+    const int width = ctx.warp.width;
+    for (int lane = 0; lane < width; lane++) {
+        result[lane] = f(a[lane], b[lane]);
+    }
+    return storeLanes(dst, result, ctx);
 }
-ErrorCode _div_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+
+template <typename F>
+static ErrorCode binaryOp(ExecutionContext &ctx, const DecodedInstr &instr, const char *name, F f)
 {
-    ExecutionContext ctx{t, warp, global};
-    OpInfo dst = decodeOperand(instr.src[0], t);
-    OpInfo lhs = decodeOperand(instr.src[1], t);
-    OpInfo rhs = decodeOperand(instr.src[2], t);
-
-    float result = eval(lhs, rhs, Opcode::DIV, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-    auto printOperand = [&](const OpInfo &op) -> std::string
-    {
-        if (op.kind == OpKind::Register)
-            return "r" + std::to_string(op.index);
-        return std::to_string(fetch(op, ctx));
-    };
-
-    std::cout << "\n[T" << t.id() << "] DIV "
-              << printOperand(lhs) << " / "
-              << printOperand(rhs) << " -> "
-              << (dst.kind == OpKind::Register ? "r" + std::to_string(dst.index) : dst.var.name)
-              << "\n";
+    if (instr.numOperands < 3) {
+        std::cerr << name << " error: insufficient operands\n";
+        return ErrorCode::InvalidMemorySpace;
+    }
+    const DecodedOperand &dst = instr.src[0];
+    const DecodedOperand &lhs = instr.src[1];
+    const DecodedOperand &rhs = instr.src[2];
 
-    return ErrorCode::None;
+    return laneOp(ctx, dst, lhs, rhs, f);
 }
 
-ErrorCode _neg_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _add_(ExecutionContext &ctx, const DecodedInstr &instr)
+{
+    return binaryOp(ctx, instr, "ADD", [](auto a, auto b) { return a + b; });
+}
+ErrorCode _sub_(ExecutionContext &ctx, const DecodedInstr &instr)
+{
+    return binaryOp(ctx, instr, "SUB", [](auto a, auto b) { return a - b; });
+}
+ErrorCode _mul_(ExecutionContext &ctx, const DecodedInstr &instr)
+{
+    return binaryOp(ctx, instr, "MUL", [](auto a, auto b) { return a * b; });
+}
+ErrorCode _div_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    ExecutionContext ctx{t, warp, global};
+    if (instr.numOperands >= 3) {
+        alignas(64) float scratch[MAX_WARP_SIZE];
+        const float *b = fetchLanes(instr.src[2], ctx, scratch);
+        for (int lane = 0; lane < ctx.warp.size(); lane++) {
+            if (laneActive(ctx.mask, lane) && b[lane] == 0.0f)
+                throw std::runtime_error("DIV by zero");
+        }
+    }
+    return binaryOp(ctx, instr, "DIV", [](auto a, auto b) { return a / b; });
+}
 
-    if (instr.src.size() < 2) {
+ErrorCode _neg_(ExecutionContext &ctx, const DecodedInstr &instr)
+{
+    if (instr.numOperands < 2) {
         std::cerr << "NEG error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    std::string dst_str, src_str;
-    try {
-        dst_str = std::get<std::string>(instr.src[0]);
-        src_str = std::get<std::string>(instr.src[1]);
-    } catch (const std::bad_variant_access& e) {
-        std::cerr << "NEG error: operands must be strings\n";
-        return ErrorCode::StringReq;
-    }
-    
-    OpInfo dst = decodeOperand(dst_str, t);
-    OpInfo src = decodeOperand(src_str, t);
-    float result = eval(dst, src, Opcode::NEG, ctx);
-    auto printOperand = [&](const OpInfo &op) -> std::string
-    {
-        if (op.kind == OpKind::Register)
-            return "r" + std::to_string(op.index);
-        return std::to_string(fetch(op, ctx));
-    };
-    std::cout << "\n[T" << t.id() << "] NEG "
-              << printOperand(dst) << " *-1 "
-              << printOperand(src) << " -> "
-              << (dst.kind == OpKind::Register ? "r" + std::to_string(dst.index) : dst.var.name)
-              << "\n";
-    return ErrorCode::None;
+
+    const DecodedOperand &dst = instr.src[0];
+    const DecodedOperand &src = instr.src[1];
+    return laneOp(ctx, dst, src, src, [](auto a, auto) { return a * -1; });
 }
-ErrorCode _mov_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _mov_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    ExecutionContext ctx{t, warp, global};
-    OpInfo dest = decodeOperand(instr.src[0], t);
-    OpInfo src = decodeOperand(instr.src[1], t);
-    float result = eval(dest, src, Opcode::MOV, ctx);
-    if (dest.index >= 0 && dest.index < t._registers.size()) {
-        t._registers[dest.index] = result;
-    } else {
-        std::cerr << "MOV error: invalid register index " << dest.index << "\n";
+    if (instr.numOperands < 2) {
+        std::cerr << "MOV error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
+    const DecodedOperand &dest = instr.src[0];
+    const DecodedOperand &src = instr.src[1];
+    if (dest.kind != OpKind::Register && dest.kind != OpKind::Address) {
+        std::cerr << "MOV error: destination must be a register\n";
+        return ErrorCode::InvalidMemorySpace;
+    }
+    ErrorCode err = laneOp(ctx, dest, src, src, [](auto a, auto) { return a; });
+    if (err == ErrorCode::InexactPointer) {
+        std::cerr << "MOV error: " << describeOperand(src, ctx.program) << " is not a whole address\n";
+        return err;
+    }
+    if (err != ErrorCode::None) {
+        std::cerr << "MOV error: invalid register index " << dest.index << "\n";
+        return err;
+    }
+    return ErrorCode::None;
+}
 
-    if (src.kind == OpKind::Register)
-    {
-        std::cout << "\n[T" << t.id() << "] MOV r" << src.index << " -> r" << dest.index << "\n";
+static const char *errorWhere(ErrorCode err)
+{
+    switch (err) {
+        case ErrorCode::GlobalOutOfBounds: return "global memory address out of bounds";
+        case ErrorCode::SharedOutOfBounds: return "shared memory address out of bounds";
+        case ErrorCode::MisalignedAddress: return "address not aligned to the access width";
+        case ErrorCode::InexactPointer: return "pointer past 16 MiB, not exact in a float register; use an aN register";
+        default: return "invalid memory space";
     }
-    else
-    {
-        std::cout << "\n[T" << t.id() << "] MOV " << src.constVal << " -> r" << dest.index << "\n";
+}
+
+// Every lane's registers dest..dest+width-1, checked before anything moves.
+static ErrorCode laneRegisters(const ExecutionContext &ctx, const DecodedOperand &o, int width, int *regs)
+{
+    if (o.kind != OpKind::Register) return ErrorCode::InvalidMemorySpace;
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        int reg = resolveIndex(o, ctx, lane);
+        if (reg < 0 || reg + width > ctx.warp.num_registers) return ErrorCode::InvalidMemorySpace;
+        regs[lane] = reg;
     }
     return ErrorCode::None;
 }
 
-ErrorCode _ld_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+// Gathers `width` consecutive words from each lane's address into its
+// registers dest..dest+width-1.
+ErrorCode _ld_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    if (instr.src.size() < 2) {
+    if (instr.numOperands < 2) {
         std::cerr << "LD error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    std::string src, dest;
-    try {
-        src = std::get<std::string>(instr.src[1]);
-        dest = std::get<std::string>(instr.src[0]);
-    } catch (const std::bad_variant_access& e) {
-        std::cerr << "LD error: operands must be strings\n";
-        return ErrorCode::StringReq;
-    }
 
-    int src_idx = getMemoryLocation(src);
-    int dest_idx = getRegisterName(dest);
+    const DecodedOperand &dest = instr.src[0];
+    const DecodedOperand &src = instr.src[1];
+    const int width = instr.width;
+    Warp &warp = ctx.warp;
 
-    if (dest_idx < 0 || dest_idx >= t._registers.size()) {
-        std::cerr << "LD error: invalid destination register index " << dest_idx << "\n";
+    int regs[MAX_WARP_SIZE];
+    int addrs[MAX_WARP_SIZE];
+    if (laneRegisters(ctx, dest, width, regs) != ErrorCode::None) {
+        std::cerr << "LD error: invalid destination register\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    if (src.find("gm") != std::string::npos)
-    {
-        if (src_idx == TIDX_RETURN_VAL)
-        {
-            int addr = t.id();
-            if (addr >= 0 && addr < global.size()) {
-                t._registers[dest_idx] = global[addr];
-            } else {
-                std::cerr << "LD error: global memory address out of bounds: " << addr << "\n";
-                return ErrorCode::GlobalOutOfBounds;
-            }
-        }
-        else if (src_idx >= global.size())
-        {
-            std::cerr << "LD error: global out of bounds\n";
-            return ErrorCode::GlobalOutOfBounds;
-        }
-        else
-        {
-            t._registers[dest_idx] = global[src_idx];
-        }
-    }
-    else if (src.find("sm") != std::string::npos)
-    {
-        if (src_idx == TIDX_RETURN_VAL)
-        {
-            int addr = t.id();
-            if (addr >= 0 && addr < warp.memory.size()) {
-                t._registers[dest_idx] = warp.memory[addr];
-            } else {
-                std::cerr << "LD error: shared memory address out of bounds: " << addr << "\n";
-                return ErrorCode::SharedOutOfBounds;
-            }
-        }
-        else if (src_idx >= warp.memory.size())
-        {
-            std::cerr << "LD error: shared/warp out of bounds\n";
-            return ErrorCode::SharedOutOfBounds;
-        }
-        else
-        {
-            t._registers[dest_idx] = warp.memory[src_idx];
-        }
-    }
-    else
-    {
-        std::cerr << "LD error: invalid memory space\n";
-        return ErrorCode::InvalidMemorySpace;
+    ErrorCode err = laneAddresses(src, ctx, width, addrs);
+    if (err != ErrorCode::None) {
+        std::cerr << "LD error: " << errorWhere(err) << "\n";
+        return err;
     }
-    std::cout << "\n[T" << t.id() << "] LD " << dest << " <- [" << src_idx << "]\n";
 
+    const float *mem = src.kind == OpKind::Global ? ctx.globalMem.data() : ctx.block.memory.data();
+    for (int lane = 0; lane < warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        for (int w = 0; w < width; w++) warp.reg(regs[lane] + w)[lane] = mem[addrs[lane] + w];
+    }
     return ErrorCode::None;
 }
 
-ErrorCode _st_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+// Scatters registers src..src+width-1 of each lane to its address. Global
+// stores are committed at the end of the cycle; shared ones land now.
+ErrorCode _st_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    if (instr.src.size() < 2) {
+    if (instr.numOperands < 2) {
         std::cerr << "ST error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    std::string dest, src_reg;
-    try {
-        dest = std::get<std::string>(instr.src[0]);
-        src_reg = std::get<std::string>(instr.src[1]);
-    } catch (const std::bad_variant_access& e) {
-        std::cerr << "ST error: operands must be strings\n";
-        return ErrorCode::StringReq;
-    }
-    
-    int src_idx = getRegisterName(src_reg);
-    int addr = t.id();
 
-    if (src_idx < 0 || src_idx >= t._registers.size()) {
-        std::cerr << "ST error: invalid register index " << src_idx << "\n";
+    const DecodedOperand &dest = instr.src[0];
+    const DecodedOperand &src = instr.src[1];
+    const int width = instr.width;
+    Warp &warp = ctx.warp;
+
+    int regs[MAX_WARP_SIZE];
+    int addrs[MAX_WARP_SIZE];
+    if (laneRegisters(ctx, src, width, regs) != ErrorCode::None) {
+        std::cerr << "ST error: invalid source register\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    if (dest.find("gm") != std::string::npos)
-    {
-        if (addr >= 0 && addr < global.size()) {
-            global[addr] = t._registers[src_idx];
-        } else {
-            std::cerr << "ST error: global memory address out of bounds: " << addr << "\n";
-            return ErrorCode::GlobalOutOfBounds;
-        }
+    ErrorCode err = laneAddresses(dest, ctx, width, addrs);
+    if (err != ErrorCode::None) {
+        std::cerr << "ST error: " << errorWhere(err) << "\n";
+        return err;
     }
-    else if (dest.find("sm") != std::string::npos)
-    {
-        if (addr >= 0 && addr < warp.memory.size()) {
-            warp.memory[addr] = t._registers[src_idx];
-        } else {
-            std::cerr << "ST error: shared memory address out of bounds: " << addr << "\n";
-            return ErrorCode::SharedOutOfBounds;
+
+    if (dest.kind == OpKind::Global) {
+        for (int lane = 0; lane < warp.size(); lane++) {
+            if (laneActive(ctx.mask, lane) && !ctx.globalMem.writable(addrs[lane], width)) {
+                std::cerr << "ST error: global memory address is read-only: " << addrs[lane] << "\n";
+                return ErrorCode::ReadOnlyMemory;
+            }
+        }
+        for (int lane = 0; lane < warp.size(); lane++) {
+            if (!laneActive(ctx.mask, lane)) continue;
+            for (int w = 0; w < width; w++) ctx.globalStores.push_back({addrs[lane] + w, warp.reg(regs[lane] + w)[lane]});
+        }
+    } else {
+        float *mem = ctx.block.memory.data();
+        for (int lane = 0; lane < warp.size(); lane++) {
+            if (!laneActive(ctx.mask, lane)) continue;
+            for (int w = 0; w < width; w++) mem[addrs[lane] + w] = warp.reg(regs[lane] + w)[lane];
         }
     }
-    else
-    {
-        std::cerr << "ST error: invalid memory space\n";
-        return ErrorCode::InvalidMemorySpace;
-    }
-    std::cout << "\n[T" << t.id() << "] ST r" << src_idx << " -> " << dest << "[" << addr << "]\n";
-
     return ErrorCode::None;
 }
 
-ErrorCode _halt_(Thread &t, Warp &, std::vector<float> &, const Instr &)
+ErrorCode _halt_(ExecutionContext &ctx, const DecodedInstr &)
 {
-    t.active = false;
-    std::cout << "\n[T" << t.id() << "] HALT\n";
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane)) ctx.warp.threads[lane]->active = false;
+    }
     return ErrorCode::None;
 }
 
-ErrorCode _def_(Thread &t, Warp &warp, std::vector<float> &global_mem, const Instr &instr)
+ErrorCode _def_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    if (instr.src.empty()) {
-        std::cerr << "DEF error: no operands\n";
-        return ErrorCode::InvalidMemorySpace;
-    }
-    
-    Variable var;
-    try {
-        var = std::get<Variable>(instr.src[0]);
-    } catch (const std::bad_variant_access& e) {
+    if (instr.numOperands < 1 || instr.src[0].slot < 0) {
         std::cerr << "DEF error: operand must be a Variable\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    if (var.threadIDX)
-    {
-        var.offset = t.id();
-    }
-
-    VarTable::getInstance().addVar(var, t.id());
 
-    switch (var.loc)
-    {
-    case StoreLoc::GLOBAL:
-        if (var.offset >= 0 && var.offset < global_mem.size()) {
-            global_mem[var.offset] = var.value;
-        } else {
-            std::cerr << "VAR DEF error: global memory offset out of bounds: " << var.offset << "\n";
-            return ErrorCode::GlobalOutOfBounds;
+    const DecodedOperand &dst = instr.src[0];
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        int offset = resolveIndex(dst, ctx, lane);
+        ErrorCode err = storeInLocation(dst, dst.constVal, ctx, lane);
+        if (err != ErrorCode::None) {
+            std::cerr << "VAR DEF error: offset out of bounds: " << offset << "\n";
+            return err;
         }
-        break;
-    case StoreLoc::LOCAL:
-        if (var.offset >= NUM_REGISTERS)
-        {
-            std::cerr << "VAR DEF error: variable offset larger than register count\n";
-            break;
-        }
-        if (var.offset >= 0 && var.offset < t._registers.size()) {
-            t._registers[var.offset] = var.value;
-        } else {
-            std::cerr << "VAR DEF error: register offset out of bounds: " << var.offset << "\n";
-            return ErrorCode::InvalidMemorySpace;
-        }
-        break;
-    case StoreLoc::SHARED:
-        if (var.offset >= GLOBAL_MEM_SIZE)
-        {
-            std::cerr << "VAR DEF error: variable offset larger than warp mem size\n";
-            break;
-        }
-        if (var.offset >= 0 && var.offset < warp.memory.size()) {
-            warp.memory[var.offset] = var.value;
-        } else {
-            std::cerr << "VAR DEF error: shared memory offset out of bounds: " << var.offset << "\n";
-            return ErrorCode::SharedOutOfBounds;
-        }
-        break;
-    default:
-        break;
+        // only offsets that were stored to are recorded, so checkpoints can check them
+        ctx.warp.varOffset(dst.slot, lane) = offset;
     }
 
     return ErrorCode::None;
 }
 
-ErrorCode _label_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _label_(ExecutionContext &, const DecodedInstr &instr)
 {
-    if (instr.src.size() < 2) {
+    if (instr.numOperands < 2) {
         std::cerr << "LABEL error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    if(const std::string* loop= std::get_if<std::string>(&instr.src[0])){
-        try {
-            int pos = std::get<int>(instr.src[1]);
-            labelTable::getInstance().addLabel(*loop, pos);
-        } catch (const std::bad_variant_access& e) {
-            std::cerr << "LABEL error: second operand must be an integer\n";
-            return ErrorCode::InvalidMemorySpace;
-        }
-    }else{
+
+    if (instr.src[0].kind != OpKind::Symbol) {
         std::cerr << "LABEL error: first operand has to be a string\n";
         return ErrorCode::StringReq;
     }
+    if (instr.src[1].kind != OpKind::Constant) {
+        std::cerr << "LABEL error: second operand must be an integer\n";
+        return ErrorCode::InvalidMemorySpace;
+    }
+    // resolved when the program was loaded; nothing to do at run time
     return ErrorCode::None;
 }
 
-ErrorCode _cond_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _cond_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    if (instr.src.size() < 2) {
+    if (instr.numOperands < 2) {
         std::cerr << "CMP_LT error: insufficient operands\n";
         return ErrorCode::InvalidMemorySpace;
     }
-    
-    std::string var1_name, var2_name;
-    try {
-        var1_name = std::get<std::string>(instr.src[0]);
-        var2_name = std::get<std::string>(instr.src[1]);
-    } catch (const std::bad_variant_access& e) {
-        std::cerr << "CMP_LT error: operands must be strings\n";
-        return ErrorCode::StringReq;
-    }
-    
-    std::optional<Variable> v1 = VarTable::getInstance().getVar(var1_name, t.id());
-    std::optional<Variable> v2 = VarTable::getInstance().getVar(var2_name, t.id());
-    if (!v1.has_value() || !v2.has_value()) {
+
+    const DecodedOperand &lhs = instr.src[0];
+    const DecodedOperand &rhs = instr.src[1];
+    if (lhs.kind == OpKind::Invalid || rhs.kind == OpKind::Invalid) {
         std::cerr << "CMP_LT error: variable not found\n";
         return ErrorCode::VarNotFound;
     }
-    if(v1.value().value <v2.value().value){
-        t.predicateReg = true;
-        std::cout  << "\n[T" << t.id()<< "] COND FAILED CONTINUING LOOP\n";
-    }else{
-        t.predicateReg = false;
-        std::cout  << "\n[T" << t.id()<< "] EXITING LOOP\n";
-
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (!laneActive(ctx.mask, lane)) continue;
+        Thread &t = *ctx.warp.threads[lane];
+        t.predicateReg = fetchWide(lhs, ctx, lane) < fetchWide(rhs, ctx, lane);
     }
 
     return ErrorCode::None;
 }
 
-ErrorCode _jump_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _jump_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
 
-    if (instr.src.empty()) {
-        std::cerr << "JNZ error: no operands\n";
-        return ErrorCode::InvalidMemorySpace;
-    }
-    
-    std::string label_name;
-    try {
-        label_name = std::get<std::string>(instr.src[0]);
-    } catch (const std::bad_variant_access& e) {
+    if (instr.numOperands < 1 || instr.src[0].kind != OpKind::Symbol) {
         std::cerr << "JNZ error: operand must be a string\n";
         return ErrorCode::StringReq;
     }
-    
-    std::optional<int> labelPos = labelTable::getInstance().getLabel(label_name);
 
-    if(t.predicateReg){
-        t.pc = static_cast<size_t>(labelPos.value()-1);
-        std::cout << "\n[T" << t.id()<< "] JUMPED TO " << labelPos.value()-1 << "\n";
-    }else{
-        return ErrorCode::None;
+    int target = instr.src[0].index;
+    if (target < 0) {
+        std::cerr << "JMP error: undefined label " << ctx.program.symbols[instr.src[0].slot] << "\n";
+        return ErrorCode::UnknownLabel;
+    }
+
+    // the SM moves the warp (and splits it if the lanes disagree)
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane) && ctx.warp.threads[lane]->predicateReg)
+            ctx.taken |= LaneMask(1) << lane;
     }
     return ErrorCode::None;
 }
 
-ErrorCode _and_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _and_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    
-    ExecutionContext ctx{t, warp, global};
-    OpInfo a = decodeOperand(instr.src[1],t);
-    OpInfo b = decodeOperand(instr.src[2],t);
-    OpInfo dst = decodeOperand(instr.src[0],t);
-
-    
-    float result = eval(a, b, Opcode::AND, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-
-    float val_a = fetch(a, ctx);
-    float val_b = fetch(b, ctx);
-    std::cout << "\n[T" << t.id() << "] " << val_a << " AND " << val_b << "\n";
-    return ErrorCode::None;
-    return ErrorCode::None;
+    return binaryOp(ctx, instr, "AND", [](auto a, auto b) { return static_cast<decltype(a)>(toInt(a) & toInt(b)); });
 }
 
-ErrorCode _or_(Thread &t, Warp &warp, std::vector<float> &global, const Instr &instr)
+ErrorCode _or_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    ExecutionContext ctx{t, warp, global};
-    OpInfo a = decodeOperand(instr.src[1],t);
-    OpInfo b = decodeOperand(instr.src[2],t);
-    OpInfo dst = decodeOperand(instr.src[0],t);
-
-    
-    float result = eval(a, b, Opcode::OR, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-
-    float val_a = fetch(a, ctx);
-    float val_b = fetch(b, ctx);
-    std::cout << "\n[T" << t.id() << "] " << val_a << " OR " << val_b << "\n";
-    return ErrorCode::None;
-    return ErrorCode::None;
+    return binaryOp(ctx, instr, "OR", [](auto a, auto b) { return static_cast<decltype(a)>(toInt(a) | toInt(b)); });
 }
 
-ErrorCode _xor_(Thread &t, Warp &warp, std::vector<float>& global, const Instr& instr)
+ErrorCode _xor_(ExecutionContext &ctx, const DecodedInstr &instr)
 {
-    ExecutionContext ctx{t, warp, global};
-    OpInfo a = decodeOperand(instr.src[1],t);
-    OpInfo b = decodeOperand(instr.src[2],t);
-    OpInfo dst = decodeOperand(instr.src[0],t);
-
-    
-    float result = eval(a, b, Opcode::XOR, ctx);
-    ErrorCode err = storeInLocation(dst, result, ctx);
-    if (err != ErrorCode::None)
-        return err;
-
-    float val_a = fetch(a, ctx);
-    float val_b = fetch(b, ctx);
-    std::cout << "\n[T" << t.id() << "] " << val_a << " XOR " << val_b << "\n";
-    return ErrorCode::None;
+    return binaryOp(ctx, instr, "XOR", [](auto a, auto b) { return static_cast<decltype(a)>(toInt(a) ^ toInt(b)); });
 }
@@ -0,0 +1,375 @@
+// Headless batch runner: runs one kernel to completion at full speed and
+// prints stats and memory dumps. Links only libgpusim, no GUI or GL.
+#include "gpu.hpp"
+#include "operations.hpp"
+#include "kernels.hpp"
+#include "assembler.hpp"
+#include "sampling.hpp"
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+
+// "X", "X,Y" or "X,Y,Z"
+static bool parseDim(const char* text, Dim3& dim)
+{
+    char* end = nullptr;
+    int* fields[] = {&dim.x, &dim.y, &dim.z};
+    dim = Dim3{};
+    for (int i = 0; i < 3; i++) {
+        *fields[i] = static_cast<int>(std::strtol(text, &end, 10));
+        if (end == text) return false;
+        if (*end == '\0') return true;
+        if (*end != ',') return false;
+        text = end + 1;
+    }
+    return false;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "usage: " << prog << " [options]\n"
+              << "  --kernel NAME|FILE   built-in kernel or kernel source file (default: loop)\n"
+              << "  --cache-dir DIR      compiled kernel cache (default: .gpusim-cache)\n"
+              << "  --no-cache           always assemble kernel files from source\n"
+              << "  --list               list built-in kernels\n"
+              << "  --sms N              number of SMs\n"
+              << "  --warps N            warps per SM\n"
+              << "  --warp-size N        lanes per warp (max " << MAX_WARP_SIZE << ")\n"
+              << "  --regs N             registers per thread\n"
+              << "  --address-regs N     address registers (aN) per thread\n"
+              << "  --global-bytes N     global memory size\n"
+              << "  --shared-bytes N     shared memory per SM\n"
+              << "  --host-threads N     host workers, 0 = one per core\n"
+              << "  --max-blocks N       resident blocks per SM\n"
+              << "  --grid X[,Y[,Z]]     launch a grid of blocks instead of one block per SM\n"
+              << "  --block X[,Y[,Z]]    threads per block (default: one warp)\n"
+              << "  --param V            kernel parameter, read as %param0, %param1... (repeatable)\n"
+              << "  --block-shared N     shared memory bytes per block (default: what the kernel uses)\n"
+              << "  --engine NAME        handlers (default) or threaded\n"
+              << "  --scheduler NAME     lrr (default), gto or two-level\n"
+              << "  --issue-width N      warps issued per SM per cycle\n"
+              << "  --active-warps N     active set size for two-level\n"
+              << "  --timing             model opcode and memory latencies\n"
+              << "  --global-latency N   cycles for a global memory read (with --timing)\n"
+              << "  --shared-latency N   cycles for a shared memory read (with --timing)\n"
+              << "  --transaction-cycles N  replay cycles per extra global transaction (with --timing)\n"
+              << "  --bank-conflict-cycles N  replay cycles per extra shared memory pass (with --timing)\n"
+              << "  --caches             model an L1 per SM and a shared L2\n"
+              << "  --l1-bytes N         L1 size (default 16384)\n"
+              << "  --l2-bytes N         L2 size (default 524288)\n"
+              << "  --cache-policy NAME  replacement: lru (default), fifo or random\n"
+              << "  --cycles N           stop after N more cycles\n"
+              << "  --break PC           stop when a warp reaches PC (repeatable)\n"
+              << "  --sample             sampled simulation: functional fast-forward plus\n"
+              << "                       detailed timing windows, cycles are estimated\n"
+              << "  --sample-period N    warp instructions per sample period (default 100000)\n"
+              << "  --sample-warmup N    detailed warm-up instructions per period (default 2000)\n"
+              << "  --sample-window N    measured instructions per period (default 10000)\n"
+              << "  --sample-tolerance F widest trusted CI half-width as a fraction of the\n"
+              << "                       estimate (default 0.1)\n"
+              << "  --restore FILE       start from a checkpoint instead of cycle 0\n"
+              << "  --checkpoint FILE    save a checkpoint where the run stops\n"
+              << "  --counters-json FILE write performance counters as JSON\n"
+              << "  --counters-csv FILE  write performance counters as CSV\n"
+              << "  --dump-global        print global memory when done\n"
+              << "  --dump-shared        print shared memory when done\n"
+              << "  --trace LEVEL        off, instr or operands; prints the trace when done\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string kernel = "loop";
+    std::string cacheDir = ".gpusim-cache";
+    GpuConfig config;
+    long long maxCycles = 0;
+    std::vector<size_t> breakpoints;
+    bool launch = false;
+    Dim3 grid, block;
+    bool blockSet = false;
+    std::vector<double> params;
+    size_t blockShared = 0;
+    bool sample = false;
+    SamplingConfig sampling;
+    std::string restoreFile;
+    std::string checkpointFile;
+    std::string countersJson;
+    std::string countersCsv;
+    bool dumpGlobal = false;
+    bool dumpShared = false;
+    TraceLevel trace = TraceLevel::Off;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto next = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << arg << " needs a value\n";
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--kernel") kernel = next();
+        else if (arg == "--cache-dir") cacheDir = next();
+        else if (arg == "--no-cache") cacheDir.clear();
+        else if (arg == "--sms") config.num_sms = std::atoi(next());
+        else if (arg == "--warps") config.warps_per_sm = std::atoi(next());
+        else if (arg == "--warp-size") config.warp_size = std::atoi(next());
+        else if (arg == "--regs") config.registers_per_thread = std::atoi(next());
+        else if (arg == "--address-regs") config.address_registers = std::atoi(next());
+        else if (arg == "--global-bytes") config.global_mem_bytes = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--shared-bytes") config.shared_mem_bytes = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--host-threads") config.host_threads = std::atoi(next());
+        else if (arg == "--max-blocks") config.max_blocks_per_sm = std::atoi(next());
+        else if (arg == "--grid" || arg == "--block") {
+            const char* text = next();
+            if (!parseDim(text, arg == "--grid" ? grid : block)) {
+                std::cerr << "bad " << arg << ": " << text << "\n";
+                return 2;
+            }
+            launch = true;
+            blockSet = blockSet || arg == "--block";
+        }
+        else if (arg == "--param") params.push_back(std::strtod(next(), nullptr));
+        else if (arg == "--block-shared") blockShared = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--engine") {
+            std::string engine = next();
+            if (engine == "handlers") config.engine = Engine::Handlers;
+            else if (engine == "threaded") config.engine = Engine::Threaded;
+            else {
+                std::cerr << "unknown engine: " << engine << "\n";
+                return 2;
+            }
+        }
+        else if (arg == "--scheduler") {
+            std::string policy = next();
+            if (policy == "lrr") config.scheduler = SchedulerPolicy::LooseRoundRobin;
+            else if (policy == "gto") config.scheduler = SchedulerPolicy::GreedyThenOldest;
+            else if (policy == "two-level") config.scheduler = SchedulerPolicy::TwoLevel;
+            else {
+                std::cerr << "unknown scheduler: " << policy << "\n";
+                return 2;
+            }
+        }
+        else if (arg == "--issue-width") config.issue_width = std::atoi(next());
+        else if (arg == "--active-warps") config.two_level_active = std::atoi(next());
+        else if (arg == "--timing") config.timing.enabled = true;
+        else if (arg == "--global-latency") config.timing.global_latency = std::atoi(next());
+        else if (arg == "--shared-latency") config.timing.shared_latency = std::atoi(next());
+        else if (arg == "--transaction-cycles") config.timing.transaction_cycles = std::atoi(next());
+        else if (arg == "--bank-conflict-cycles") config.timing.bank_conflict_cycles = std::atoi(next());
+        else if (arg == "--caches") config.caches = true;
+        else if (arg == "--l1-bytes") config.l1.size_bytes = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--l2-bytes") config.l2.size_bytes = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--cache-policy") {
+            std::string policy = next();
+            ReplacementPolicy replacement;
+            if (policy == "lru") replacement = ReplacementPolicy::LRU;
+            else if (policy == "fifo") replacement = ReplacementPolicy::FIFO;
+            else if (policy == "random") replacement = ReplacementPolicy::Random;
+            else {
+                std::cerr << "unknown cache policy: " << policy << "\n";
+                return 2;
+            }
+            config.l1.replacement = config.l2.replacement = replacement;
+        }
+        else if (arg == "--cycles") maxCycles = std::atoll(next());
+        else if (arg == "--break") breakpoints.push_back(std::strtoull(next(), nullptr, 10));
+        else if (arg == "--sample") sample = true;
+        else if (arg == "--sample-period") sampling.period = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--sample-warmup") sampling.warmup = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--sample-window") sampling.window = std::strtoull(next(), nullptr, 10);
+        else if (arg == "--sample-tolerance") sampling.tolerance = std::atof(next());
+        else if (arg == "--restore") restoreFile = next();
+        else if (arg == "--checkpoint") checkpointFile = next();
+        else if (arg == "--counters-json") countersJson = next();
+        else if (arg == "--counters-csv") countersCsv = next();
+        else if (arg == "--dump-global") dumpGlobal = true;
+        else if (arg == "--dump-shared") dumpShared = true;
+        else if (arg == "--trace") {
+            std::string level = next();
+            if (level == "off") trace = TraceLevel::Off;
+            else if (level == "instr") trace = TraceLevel::Instructions;
+            else if (level == "operands") trace = TraceLevel::Operands;
+            else {
+                std::cerr << "unknown trace level: " << level << "\n";
+                return 2;
+            }
+        }
+        else if (arg == "--list") {
+            for (const auto& name : kernelNames()) std::cout << name << "\n";
+            return 0;
+        } else {
+            usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 2;
+        }
+    }
+
+    auto loadStart = std::chrono::steady_clock::now();
+    Program program;
+    if (auto builtin = findKernel(kernel)) {
+        program = compileProgram(*builtin);
+    } else {
+        try {
+            program = loadKernel(kernel, cacheDir);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 2;
+        }
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+
+    GPU gpu(program, config);
+    gpu.setTraceLevel(trace);
+    if (launch) {
+        if (!blockSet) block = {config.warp_size, 1, 1};
+        try {
+            gpu.launch(program, grid, block, params, blockShared);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 2;
+        }
+    }
+
+    if (!restoreFile.empty() && !gpu.restoreFromFile(restoreFile)) {
+        std::cerr << "cannot restore " << restoreFile << ": not a checkpoint of this kernel and configuration\n";
+        return 2;
+    }
+    const long long threads = static_cast<long long>(gpu.kernel.numBlocks()) * gpu.kernel.block.count();
+
+    auto dumpMemory = [&]() {
+        if (dumpGlobal) {
+            std::cout << "\nglobal memory:\n";
+            gpu.print_global_mem();
+        }
+        if (dumpShared) {
+            std::cout << "\nshared memory:";
+            gpu.print_shared_mem();
+        }
+    };
+
+    if (sample) {
+        auto start = std::chrono::steady_clock::now();
+        SampleEstimate est;
+        try {
+            est = runSampled(gpu, sampling);
+        } catch (const std::exception& e) {
+            std::cerr << "simulation error: " << e.what() << "\n";
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "kernel:        " << kernel << "\n"
+                  << "sms:           " << config.num_sms << "\n"
+                  << "threads:       " << threads << "\n"
+                  << "scheduler:     " << schedulerName(config.scheduler) << ", issue width " << config.issue_width << "\n"
+                  << "sampling:      period " << sampling.period << ", warm-up " << sampling.warmup
+                  << ", window " << sampling.window << "\n"
+                  << "warp instrs:   " << est.instructions << " (" << est.detailedInstructions << " detailed)\n"
+                  << "windows:       " << est.windows.size() << "\n"
+                  << "est. cycles:   " << est.cycles << " (95% CI " << est.cyclesLow << " - " << est.cyclesHigh << ")\n"
+                  << "est. ipc:      " << (est.cpi > 0 ? 1.0 / est.cpi : 0.0) << "\n";
+        if (!est.confident) {
+            std::cout << "warning:       " << (est.windows.size() < 2 ? "fewer than two windows"
+                                                                      : "confidence interval wider than the tolerance")
+                      << ", the estimate is not reliable\n";
+        }
+        std::cout
+                  << "wall time (s): " << seconds << "\n";
+        dumpMemory();
+        return 0;
+    }
+
+    RunMode mode = RunMode::FreeRun;
+    if (!breakpoints.empty()) {
+        mode = RunMode::Breakpoint;
+        for (size_t pc : breakpoints) gpu.addBreakpoint(pc);
+    } else if (maxCycles > 0) {
+        mode = RunMode::Cycles;
+        gpu.setCycleLimit(gpu.get_cycle() + maxCycles);
+    }
+    gpu.setRunMode(mode);
+
+    auto start = std::chrono::steady_clock::now();
+    StopReason reason;
+    try {
+        reason = gpu.runBlocking();
+    } catch (const std::exception& e) {
+        std::cerr << "simulation error: " << e.what() << "\n";
+        return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "kernel:        " << kernel << "\n"
+              << "sms:           " << config.num_sms << "\n"
+              << "threads:       " << threads << " (" << gpu.kernel.numBlocks() << " blocks of "
+                                 << gpu.kernel.block.count() << ")\n"
+              << "engine:        " << (config.engine == Engine::Threaded ? "threaded" : "handlers") << "\n"
+              << "scheduler:     " << schedulerName(config.scheduler) << ", issue width " << config.issue_width << "\n"
+              << "timing:        " << (config.timing.enabled ? "on" : "off") << "\n"
+              << "load time (ms):" << loadMs << "\n"
+              << "cycles:        " << gpu.get_cycle() << "\n"
+              << "stopped by:    " << (reason == StopReason::Finished ? "end of kernel"
+                                       : reason == StopReason::CycleLimit ? "cycle limit" : "breakpoint") << "\n"
+              << "wall time (s): " << seconds << "\n"
+              << "cycles/s:      " << (seconds > 0 ? gpu.get_cycle() / seconds : 0.0) << "\n";
+
+    if (!checkpointFile.empty() && !gpu.checkpointToFile(checkpointFile))
+        std::cerr << "could not write " << checkpointFile << "\n";
+
+    WarpCounters totals = gpu.counterTotals();
+    uint64_t activeCycles = 0, warpCycles = 0;
+    for (const auto& sm : gpu.sms) {
+        activeCycles += sm.counters.activeCycles;
+        warpCycles += sm.counters.warpCycles;
+    }
+    std::cout << "warp instrs:   " << totals.issued << "\n"
+              << "ipc:           " << (gpu.get_cycle() > 0 ? static_cast<double>(totals.issued) / gpu.get_cycle() : 0.0) << "\n"
+              << "lane util:     " << (totals.issued ? static_cast<double>(totals.activeLanes) / (totals.issued * config.warp_size) : 0.0) << "\n"
+              << "occupancy:     " << (activeCycles ? static_cast<double>(warpCycles) / (activeCycles * config.warps_per_sm) : 0.0) << "\n"
+              << "divergent:     " << totals.divergentBranches << " of " << totals.branches << " branches\n"
+              << "coalescing:    " << (totals.globalRequests ? static_cast<double>(totals.globalTransactions) / totals.globalRequests : 0.0)
+                                   << " transactions per global request, "
+                                   << (totals.globalSectors ? static_cast<double>(totals.globalBytes) / (totals.globalSectors * SECTOR_BYTES) : 0.0)
+                                   << " bytes used per byte moved\n"
+              << "bank conflicts:" << totals.bankConflicts << " over " << totals.sharedRequests
+                                   << " shared requests\n";
+    // the instructions to look at when tuning a shared memory layout
+    for (const auto& [at, passes] : gpu.bankConflictsByInstruction()) {
+        const Program& code = gpu.kernelProgram(at.first);
+        const DecodedInstr& instr = code.code[at.second];
+        std::cout << "  pc " << at.second << " " << mnemonic(instr);
+        for (int i = 0; i < instr.numOperands; i++) std::cout << (i ? ", " : " ") << describeOperand(instr.src[i], code);
+        std::cout << ": " << passes << "\n";
+    }
+    if (config.caches) {
+        for (int l = 0; l < NUM_CACHE_LEVELS; l++) {
+            const uint64_t* e = totals.cache[l];
+            const uint64_t hits = e[static_cast<int>(CacheEvent::ReadHit)] + e[static_cast<int>(CacheEvent::WriteHit)];
+            const uint64_t accesses = hits + e[static_cast<int>(CacheEvent::ReadMiss)] + e[static_cast<int>(CacheEvent::WriteMiss)];
+            std::cout << "l" << l + 1 << " hit rate:   " << (accesses ? static_cast<double>(hits) / accesses : 0.0)
+                      << " of " << accesses << " lines, " << e[static_cast<int>(CacheEvent::Eviction)] << " evictions, "
+                      << e[static_cast<int>(CacheEvent::Writeback)] << " writebacks\n";
+        }
+    }
+    if (!countersJson.empty()) {
+        std::ofstream out(countersJson);
+        writeCountersJson(out, gpu);
+        if (!out) std::cerr << "could not write " << countersJson << "\n";
+    }
+    if (!countersCsv.empty()) {
+        std::ofstream out(countersCsv);
+        writeCountersCsv(out, gpu);
+        if (!out) std::cerr << "could not write " << countersCsv << "\n";
+    }
+
+    if (trace != TraceLevel::Off) {
+        std::cout << "\ntrace:\n";
+        for (const auto& rec : gpu.traceSnapshot()) {
+            std::cout << formatTrace(rec, gpu.kernelProgram(rec.kernel)) << "\n";
+        }
+    }
+    dumpMemory();
+    return 0;
+}
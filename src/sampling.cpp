@@ -0,0 +1,73 @@
+#include "sampling.hpp"
+#include "gpu.hpp"
+#include <cmath>
+
+// Runs detailed cycles until at least `instructions` warp instructions
+// issued or the kernel ended; returns how many issued.
+static uint64_t runDetailed(GPU& gpu, uint64_t instructions)
+{
+    uint64_t issued = 0;
+    while (issued < instructions && !gpu.isFinished()) {
+        gpu.step();
+        for (const auto& sm : gpu.sms) issued += sm.issuedThisCycle;
+    }
+    return issued;
+}
+
+// Each period starts with its detailed part, so any kernel longer than
+// the warm-up gets at least one window.
+SampleEstimate runSampled(GPU& gpu, const SamplingConfig& config)
+{
+    SampleEstimate est;
+    const uint64_t detailed = config.warmup + config.window;
+    const uint64_t skip = config.period > detailed ? config.period - detailed : 0;
+
+    while (!gpu.isFinished()) {
+        gpu.setTiming(true);
+        uint64_t warm = runDetailed(gpu, config.warmup);
+        est.instructions += warm;
+        est.detailedInstructions += warm;
+        if (gpu.isFinished()) break;
+
+        WarpCounters before = gpu.counterTotals();
+        long long start = gpu.get_cycle();
+        uint64_t measured = runDetailed(gpu, config.window);
+        est.instructions += measured;
+        est.detailedInstructions += measured;
+        WarpCounters delta = gpu.counterTotals();
+        delta -= before;
+        est.sampled += delta;
+        if (measured > 0)
+            est.windows.push_back({measured, static_cast<uint64_t>(gpu.get_cycle() - start)});
+
+        gpu.setTiming(false);
+        for (uint64_t done = 0; done < skip && !gpu.isFinished();) {
+            uint64_t n = gpu.stepFunctional();
+            done += n;
+            est.instructions += n;
+        }
+    }
+    gpu.setTiming(gpu.config.timing.enabled);
+
+    const size_t n = est.windows.size();
+    if (n == 0) return est;
+    double sum = 0;
+    for (const auto& w : est.windows) sum += static_cast<double>(w.cycles) / w.instructions;
+    est.cpi = sum / n;
+    est.cycles = est.cpi * est.instructions;
+    est.cyclesLow = est.cyclesHigh = est.cycles;
+    if (n > 1) {
+        double var = 0;
+        for (const auto& w : est.windows) {
+            double d = static_cast<double>(w.cycles) / w.instructions - est.cpi;
+            var += d * d;
+        }
+        double half = 1.96 * std::sqrt(var / (n - 1) / n) * est.instructions;
+        est.cyclesLow = est.cycles - half;
+        est.cyclesHigh = est.cycles + half;
+        est.confident = half <= config.tolerance * est.cycles;
+    }
+    if (est.sampled.issued > 0)
+        est.scale = static_cast<double>(est.instructions) / est.sampled.issued;
+    return est;
+}
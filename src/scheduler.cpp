@@ -0,0 +1,142 @@
+#include "scheduler.hpp"
+#include <algorithm>
+
+void LooseRoundRobin::select(const std::vector<char>& ready, int width, std::vector<int>& out)
+{
+    const size_t n = ready.size();
+    for (size_t i = 0; i < n && static_cast<int>(out.size()) < width; i++) {
+        size_t w = (next + i) % n;
+        if (!ready[w]) continue;
+        out.push_back(static_cast<int>(w));
+    }
+    if (!out.empty()) next = (out.back() + 1) % n;
+}
+
+void LooseRoundRobin::save(std::string& out) const
+{
+    put(out, static_cast<uint64_t>(next));
+}
+
+bool LooseRoundRobin::load(Reader& in)
+{
+    uint64_t n;
+    if (!in.get(n)) return false;
+    next = static_cast<size_t>(n);
+    return true;
+}
+
+void GreedyThenOldest::select(const std::vector<char>& ready, int width, std::vector<int>& out)
+{
+    if (width < 1) return;
+    if (greedy >= 0 && greedy < static_cast<int>(ready.size()) && ready[greedy]) out.push_back(greedy);
+    for (size_t w = 0; w < ready.size() && static_cast<int>(out.size()) < width; w++) {
+        if (ready[w] && static_cast<int>(w) != greedy) out.push_back(static_cast<int>(w));
+    }
+    // the first warp picked is the one to stay greedy on
+    greedy = out.empty() ? -1 : out.front();
+}
+
+void GreedyThenOldest::save(std::string& out) const
+{
+    put(out, static_cast<int32_t>(greedy));
+}
+
+bool GreedyThenOldest::load(Reader& in)
+{
+    int32_t g;
+    if (!in.get(g)) return false;
+    greedy = g;
+    return true;
+}
+
+TwoLevel::TwoLevel(int num_warps, int active_size)
+    : activeSize(static_cast<size_t>(std::max(1, active_size))), numWarps(num_warps)
+{
+    for (int w = 0; w < num_warps; w++) {
+        if (active.size() < activeSize) active.push_back(w);
+        else pending.push_back(w);
+    }
+}
+
+void TwoLevel::select(const std::vector<char>& ready, int width, std::vector<int>& out)
+{
+    // demote stalled warps, then refill from the pending queue
+    for (size_t i = 0; i < active.size();) {
+        if (ready[active[i]]) {
+            i++;
+            continue;
+        }
+        pending.push_back(active[i]);
+        active.erase(active.begin() + i);
+    }
+    for (size_t scanned = 0, n = pending.size(); scanned < n && active.size() < activeSize; scanned++) {
+        int w = pending.front();
+        pending.pop_front();
+        if (ready[w]) active.push_back(w);
+        else pending.push_back(w);
+    }
+
+    if (active.empty()) return;
+    const size_t n = active.size();
+    size_t start = next % n;
+    for (size_t i = 0; i < n && static_cast<int>(out.size()) < width; i++) {
+        out.push_back(active[(start + i) % n]);
+    }
+    next = start + 1;
+}
+
+void TwoLevel::save(std::string& out) const
+{
+    put(out, static_cast<uint64_t>(next));
+    put(out, static_cast<uint32_t>(active.size()));
+    putArray(out, active.data(), active.size());
+    put(out, static_cast<uint32_t>(pending.size()));
+    for (int w : pending) put(out, static_cast<int32_t>(w));
+}
+
+bool TwoLevel::load(Reader& in)
+{
+    // a count is only trusted if that many entries can still follow, and
+    // every entry has to be one of this SM's warps
+    auto warps = [&](auto& out) {
+        uint32_t count = 0;
+        if (!in.get(count) || count > static_cast<size_t>(in.end - in.p) / sizeof(int32_t)) return false;
+        for (uint32_t i = 0; i < count; i++) {
+            int32_t w = 0;
+            if (!in.get(w) || w < 0 || w >= numWarps) return false;
+            out.push_back(w);
+        }
+        return true;
+    };
+    uint64_t n = 0;
+    std::vector<int> a;
+    std::deque<int> p;
+    if (!in.get(n) || !warps(a) || !warps(p)) return false;
+    next = static_cast<size_t>(n);
+    active = std::move(a);
+    pending = std::move(p);
+    return true;
+}
+
+std::unique_ptr<WarpScheduler> makeScheduler(SchedulerPolicy policy, int num_warps, int active_size)
+{
+    switch (policy) {
+        case SchedulerPolicy::GreedyThenOldest:
+            return std::make_unique<GreedyThenOldest>();
+        case SchedulerPolicy::TwoLevel:
+            return std::make_unique<TwoLevel>(num_warps, active_size);
+        case SchedulerPolicy::LooseRoundRobin:
+            break;
+    }
+    return std::make_unique<LooseRoundRobin>();
+}
+
+const char* schedulerName(SchedulerPolicy policy)
+{
+    switch (policy) {
+        case SchedulerPolicy::LooseRoundRobin: return "lrr";
+        case SchedulerPolicy::GreedyThenOldest: return "gto";
+        case SchedulerPolicy::TwoLevel: return "two-level";
+    }
+    return "?";
+}
@@ -0,0 +1,256 @@
+#include "gpu.hpp"
+#include "threaded.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+int GPU::addKernel(const Program& kernel)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto loaded = std::make_unique<LoadedKernel>();
+    loaded->program = kernel;
+    loaded->threaded = std::make_unique<ThreadedProgram>(loaded->program, config.registers_per_thread);
+    kernels.push_back(std::move(loaded));
+    return static_cast<int>(kernels.size());
+}
+
+const Program& GPU::kernelProgram(int handle) const
+{
+    if (handle == 0) return program;
+    if (handle < 0 || handle > static_cast<int>(kernels.size()))
+        throw std::out_of_range("no kernel " + std::to_string(handle));
+    return kernels[handle - 1]->program;
+}
+
+int GPU::createStream()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    streams.emplace_back();
+    return static_cast<int>(streams.size()) - 1;
+}
+
+int GPU::createEvent()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    events.emplace_back();
+    return static_cast<int>(events.size()) - 1;
+}
+
+static void checkHandle(int handle, size_t count, const char* what)
+{
+    if (handle < 0 || static_cast<size_t>(handle) >= count)
+        throw std::out_of_range(std::string("no ") + what + " " + std::to_string(handle));
+}
+
+void GPU::launchAsync(int stream, int handle, Dim3 grid, Dim3 block, const std::vector<double>& params,
+                      size_t shared_bytes)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(stream, streams.size(), "stream");
+    const Program& code = kernelProgram(handle);
+    size_t words = shared_bytes ? (shared_bytes + sizeof(float) - 1) / sizeof(float)
+                                : sharedWordsUsed(code, block.count());
+    // rejected here rather than when the stream reaches it
+    checkLaunch(grid, block, words);
+    StreamOp op{};
+    op.kind = StreamOp::Kernel;
+    op.kernel = handle;
+    op.grid = grid;
+    op.block = block;
+    op.sharedWords = words;
+    op.params = params;
+    // like launch(), but temporaries of kernels still queued or running stay
+    uint64_t busy = UINT64_MAX;
+    for (const auto& s : streams) {
+        for (const auto& queued : s.ops) {
+            if (queued.kind == StreamOp::Kernel) busy = std::min(busy, queued.temps);
+        }
+    }
+    op.temps = allocator.newLaunch(busy);
+    streams[stream].ops.push_back(std::move(op));
+}
+
+void GPU::copyToDeviceAsync(int stream, size_t deviceWord, const float* src, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(stream, streams.size(), "stream");
+    if (deviceWord > global_memory.size() || count > global_memory.size() - deviceWord)
+        throw std::out_of_range("copyToDeviceAsync: words " + std::to_string(deviceWord) + "+" +
+                                std::to_string(count) + " past global memory");
+    if (!global_memory.writable(deviceWord, count))
+        throw std::invalid_argument("copyToDeviceAsync: destination is mapped read-only");
+    StreamOp op{};
+    op.kind = StreamOp::CopyToDevice;
+    op.deviceWord = deviceWord;
+    op.count = count;
+    op.data.assign(src, src + count);
+    streams[stream].ops.push_back(std::move(op));
+}
+
+void GPU::copyToHostAsync(int stream, float* dst, size_t deviceWord, size_t count)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(stream, streams.size(), "stream");
+    if (deviceWord > global_memory.size() || count > global_memory.size() - deviceWord)
+        throw std::out_of_range("copyToHostAsync: words " + std::to_string(deviceWord) + "+" +
+                                std::to_string(count) + " past global memory");
+    StreamOp op{};
+    op.kind = StreamOp::CopyToHost;
+    op.deviceWord = deviceWord;
+    op.host = dst;
+    op.count = count;
+    streams[stream].ops.push_back(std::move(op));
+}
+
+void GPU::recordEvent(int event, int stream)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(event, events.size(), "event");
+    checkHandle(stream, streams.size(), "stream");
+    StreamOp op{};
+    op.kind = StreamOp::RecordEvent;
+    op.event = event;
+    op.sequence = ++events[event].recorded;
+    streams[stream].ops.push_back(std::move(op));
+}
+
+// The recording waited for is fixed now, so recording the event again
+// later does not hold this stream back, and a wait can never deadlock.
+void GPU::waitEvent(int stream, int event)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(stream, streams.size(), "stream");
+    checkHandle(event, events.size(), "event");
+    StreamOp op{};
+    op.kind = StreamOp::WaitEvent;
+    op.event = event;
+    op.sequence = events[event].recorded;
+    streams[stream].ops.push_back(std::move(op));
+}
+
+bool GPU::eventDone(int event)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(event, events.size(), "event");
+    return events[event].completed == events[event].recorded;
+}
+
+uint64_t GPU::eventCycle(int event)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    checkHandle(event, events.size(), "event");
+    return events[event].cycle;
+}
+
+bool GPU::streamsIdle() const
+{
+    return std::all_of(streams.begin(), streams.end(), [](const Stream& s) { return s.ops.empty(); });
+}
+
+void GPU::synchronize()
+{
+    stop();
+    while (step()) {}
+    finished = isFinished();
+}
+
+void GPU::synchronizeStream(int stream)
+{
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        checkHandle(stream, streams.size(), "stream");
+    }
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (streams[stream].ops.empty()) break;
+        }
+        step();
+    }
+}
+
+void GPU::synchronizeEvent(int event)
+{
+    stop();
+    while (!eventDone(event)) step();
+}
+
+// Retires finished operations at the head of each stream and starts the
+// next ones; called between cycles with the lock held. True if any retired.
+bool GPU::advanceStreams()
+{
+    const uint64_t now = static_cast<uint64_t>(cycle_count);
+    const size_t bandwidth = config.copy_bytes_per_cycle;
+    bool retired = false;
+    for (auto& stream : streams) {
+        while (!stream.ops.empty()) {
+            StreamOp& op = stream.ops.front();
+            bool done = false;
+            switch (op.kind) {
+                case StreamOp::Kernel:
+                    if (!op.launch) {
+                        KernelLaunch& launch = streamLaunches.emplace_back();
+                        launch.program = &kernelProgram(op.kernel);
+                        launch.threaded = op.kernel ? kernels[op.kernel - 1]->threaded.get() : threaded.get();
+                        launch.kernel = op.kernel;
+                        launch.grid = op.grid;
+                        launch.block = op.block;
+                        launch.params = std::move(op.params);
+                        launch.sharedWords = op.sharedWords;
+                        launch.warpsPerBlock = (op.block.count() + config.warp_size - 1) / config.warp_size;
+                        op.launch = &launch;
+                    }
+                    done = op.launch->done();
+                    if (done) {
+                        streamLaunches.remove_if([&](const KernelLaunch& l) { return &l == op.launch; });
+                    }
+                    break;
+                case StreamOp::CopyToDevice:
+                case StreamOp::CopyToHost:
+                    if (!op.started) {
+                        const size_t bytes = op.count * sizeof(float);
+                        op.started = true;
+                        op.doneAt = now + (bandwidth ? (bytes + bandwidth - 1) / bandwidth : 0);
+                    }
+                    done = now >= op.doneAt;
+                    // the data moves at the end, so kernels on other streams
+                    // see all of it or none of it
+                    if (done && op.kind == StreamOp::CopyToDevice) {
+                        std::copy(op.data.begin(), op.data.end(), global_memory.begin() + op.deviceWord);
+                    } else if (done) {
+                        std::copy_n(global_memory.begin() + op.deviceWord, op.count, op.host);
+                    }
+                    break;
+                case StreamOp::RecordEvent: {
+                    Event& event = events[op.event];
+                    if (op.sequence > event.completed) {
+                        event.completed = op.sequence;
+                        event.cycle = now;
+                    }
+                    done = true;
+                    break;
+                }
+                case StreamOp::WaitEvent:
+                    done = events[op.event].completed >= op.sequence;
+                    break;
+            }
+            if (!done) break;
+            stream.ops.pop_front();
+            retired = true;
+        }
+    }
+    return retired;
+}
+
+// First cycle a copy in flight completes, UINT64_MAX if none is.
+uint64_t GPU::copyWake() const
+{
+    uint64_t wake = UINT64_MAX;
+    for (const auto& stream : streams) {
+        if (stream.ops.empty()) continue;
+        const StreamOp& op = stream.ops.front();
+        if (op.started) wake = std::min(wake, op.doneAt);
+    }
+    return wake;
+}
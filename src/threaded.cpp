@@ -0,0 +1,330 @@
+#include "threaded.hpp"
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+
+// How an operand is read, fixed at translation time.
+enum Src { Reg, Const, Other };
+
+template <int K> struct Lanes;
+
+template <> struct Lanes<Reg> {
+    const float* p;
+    Lanes(const DecodedOperand& o, ExecutionContext& ctx, float*) : p(ctx.warp.reg(o.index)) {}
+    float operator[](int lane) const { return p[lane]; }
+};
+
+template <> struct Lanes<Const> {
+    float v;
+    Lanes(const DecodedOperand& o, ExecutionContext&, float*) : v(o.constVal) {}
+    float operator[](int) const { return v; }
+};
+
+template <> struct Lanes<Other> {
+    const float* p;
+    Lanes(const DecodedOperand& o, ExecutionContext& ctx, float* scratch) : p(fetchLanes(o, ctx, scratch)) {}
+    float operator[](int lane) const { return p[lane]; }
+};
+
+static int toInt(float v) { return static_cast<int>(v); }
+
+struct AddOp { static float apply(float a, float b) { return a + b; } };
+struct SubOp { static float apply(float a, float b) { return a - b; } };
+struct MulOp { static float apply(float a, float b) { return a * b; } };
+struct DivOp { static float apply(float a, float b) { return a / b; } };
+struct AndOp { static float apply(float a, float b) { return static_cast<float>(toInt(a) & toInt(b)); } };
+struct OrOp  { static float apply(float a, float b) { return static_cast<float>(toInt(a) | toInt(b)); } };
+struct XorOp { static float apply(float a, float b) { return static_cast<float>(toInt(a) ^ toInt(b)); } };
+struct NegOp { static float apply(float a, float) { return a * -1; } };
+struct MovOp { static float apply(float a, float) { return a; } };
+
+// dst = Op(src[lhs], src[rhs]); unary ops pass the same operand twice.
+template <typename Op, int D, int A, int B, int LHS, int RHS>
+ErrorCode alu(ExecutionContext& ctx, const DecodedInstr& in)
+{
+    alignas(64) float scratchA[MAX_WARP_SIZE];
+    alignas(64) float scratchB[MAX_WARP_SIZE];
+    Lanes<A> a(in.src[LHS], ctx, scratchA);
+    Lanes<B> b(in.src[RHS], ctx, scratchB);
+    const int width = ctx.warp.width;
+    const LaneMask mask = ctx.mask;
+
+    if (std::is_same<Op, DivOp>::value) {
+        for (int lane = 0; lane < width; lane++) {
+            if (laneActive(mask, lane) && b[lane] == 0.0f) throw std::runtime_error("DIV by zero");
+        }
+    }
+
+    if (D == Reg) {
+        float* row = ctx.warp.reg(in.src[0].index);
+        for (int lane = 0; lane < width; lane++) {
+            row[lane] = laneActive(mask, lane) ? Op::apply(a[lane], b[lane]) : row[lane];
+        }
+        return ErrorCode::None;
+    }
+    alignas(64) float result[MAX_WARP_SIZE];
+    for (int lane = 0; lane < width; lane++) {
+        result[lane] = Op::apply(a[lane], b[lane]);
+    }
+    return storeLanes(in.src[0], result, ctx);
+}
+
+// Picks the instantiation for a given (dst, lhs, rhs) combination.
+template <typename Op, int D, int A, int LHS, int RHS>
+HandlerFn pickRhs(int b)
+{
+    switch (b) {
+        case Reg: return alu<Op, D, A, Reg, LHS, RHS>;
+        case Const: return alu<Op, D, A, Const, LHS, RHS>;
+        default: return alu<Op, D, A, Other, LHS, RHS>;
+    }
+}
+
+template <typename Op, int D, int LHS, int RHS>
+HandlerFn pickLhs(int a, int b)
+{
+    switch (a) {
+        case Reg: return pickRhs<Op, D, Reg, LHS, RHS>(b);
+        case Const: return pickRhs<Op, D, Const, LHS, RHS>(b);
+        default: return pickRhs<Op, D, Other, LHS, RHS>(b);
+    }
+}
+
+template <typename Op, int LHS, int RHS>
+HandlerFn pick(int d, int a, int b)
+{
+    return d == Reg ? pickLhs<Op, Reg, LHS, RHS>(a, b) : pickLhs<Op, Other, LHS, RHS>(a, b);
+}
+
+// predicate = src[0] < src[1], per lane
+template <int A, int B>
+ErrorCode less(ExecutionContext& ctx, const DecodedInstr& in)
+{
+    alignas(64) float scratchA[MAX_WARP_SIZE];
+    alignas(64) float scratchB[MAX_WARP_SIZE];
+    Lanes<A> a(in.src[0], ctx, scratchA);
+    Lanes<B> b(in.src[1], ctx, scratchB);
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane)) ctx.warp.threads[lane]->predicateReg = a[lane] < b[lane];
+    }
+    return ErrorCode::None;
+}
+
+template <int A>
+HandlerFn pickLess(int b)
+{
+    switch (b) {
+        case Reg: return less<A, Reg>;
+        case Const: return less<A, Const>;
+        default: return less<A, Other>;
+    }
+}
+
+Src classify(const DecodedOperand& o, int num_registers)
+{
+    if (o.kind == OpKind::Constant) return Const;
+    if (o.kind == OpKind::Register && !o.tidx && o.index >= 0 && o.index < num_registers) return Reg;
+    return Other;
+}
+
+HandlerFn specialize(const DecodedInstr& in, int num_registers)
+{
+    auto cls = [&](int i) { return classify(in.src[i], num_registers); };
+    switch (in.op) {
+        // pointer arithmetic into address registers stays in the generic handlers
+        case Opcode::ADD: case Opcode::SUB: case Opcode::MUL: case Opcode::DIV:
+        case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+            if (in.numOperands < 3 || cls(0) == Const || in.src[0].kind == OpKind::Address) return nullptr;
+            break;
+        case Opcode::NEG:
+            if (in.numOperands < 2 || cls(0) == Const || in.src[0].kind == OpKind::Address) return nullptr;
+            break;
+        case Opcode::MOV:
+            // the generic handler reports non-register destinations
+            if (in.numOperands < 2 || in.src[0].kind != OpKind::Register) return nullptr;
+            break;
+        case Opcode::CMP_LT: {
+            // as are comparisons that need pointers exact
+            auto generic = [&](int i) {
+                const OpKind k = in.src[i].kind;
+                return k == OpKind::Invalid || k == OpKind::Address || k == OpKind::Param;
+            };
+            if (in.numOperands < 2 || generic(0) || generic(1)) return nullptr;
+            switch (cls(0)) {
+                case Reg: return pickLess<Reg>(cls(1));
+                case Const: return pickLess<Const>(cls(1));
+                default: return pickLess<Other>(cls(1));
+            }
+        }
+        default:
+            return nullptr;
+    }
+    int d = cls(0) == Reg ? Reg : Other;
+    switch (in.op) {
+        case Opcode::ADD: return pick<AddOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::SUB: return pick<SubOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::MUL: return pick<MulOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::DIV: return pick<DivOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::AND: return pick<AndOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::OR: return pick<OrOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::XOR: return pick<XorOp, 1, 2>(d, cls(1), cls(2));
+        case Opcode::NEG: return pick<NegOp, 1, 1>(d, cls(1), cls(1));
+        case Opcode::MOV: return pick<MovOp, 1, 1>(d, cls(1), cls(1));
+        default: return nullptr;
+    }
+}
+
+// An LD/ST whose register side is a fixed run of registers the warp has and
+// whose memory side is global or shared gets its own class; the address
+// checks still happen per issue.
+bool fixedTransfer(const DecodedInstr& in, int num_registers, int& reg)
+{
+    if (in.numOperands < 2) return false;
+    const DecodedOperand& r = in.op == Opcode::LD ? in.src[0] : in.src[1];
+    const DecodedOperand& m = in.op == Opcode::LD ? in.src[1] : in.src[0];
+    if (r.kind != OpKind::Register || r.tidx || r.index < 0 || r.index + in.width > num_registers) return false;
+    if (m.kind != OpKind::Global && m.kind != OpKind::Shared) return false;
+    reg = r.index;
+    return true;
+}
+
+ThreadedProgram::Op translate(const DecodedInstr& in, int num_registers)
+{
+    ThreadedProgram::Op op;
+    op.width = in.width;
+    switch (in.op) {
+        case Opcode::HALT:
+            op.cls = ThreadedProgram::Halt;
+            return op;
+        case Opcode::LD:
+        case Opcode::ST:
+            if (fixedTransfer(in, num_registers, op.reg)) {
+                op.cls = in.op == Opcode::LD ? ThreadedProgram::Load : ThreadedProgram::Store;
+                return op;
+            }
+            break;
+        case Opcode::JMP:
+            if (in.numOperands >= 1 && in.src[0].kind == OpKind::Symbol && in.src[0].index >= 0) {
+                op.cls = ThreadedProgram::Jump;
+                return op;
+            }
+            break;
+        case Opcode::LABEL:
+            // bound at load time; only a malformed one has anything to report
+            if (in.numOperands >= 2 && in.src[0].kind == OpKind::Symbol && in.src[1].kind == OpKind::Constant) {
+                op.cls = ThreadedProgram::Nop;
+                return op;
+            }
+            break;
+        default:
+            op.fn = specialize(in, num_registers);
+            break;
+    }
+    op.cls = ThreadedProgram::Call;
+    if (!op.fn) op.fn = opcode_handlers[static_cast<int>(in.op)];
+    return op;
+}
+
+ErrorCode load(const ThreadedProgram::Op& op, ExecutionContext& ctx, const DecodedInstr& in)
+{
+    int addrs[MAX_WARP_SIZE];
+    const DecodedOperand& src = in.src[1];
+    // a faulting access moves nothing, so the generic handler can report it
+    if (laneAddresses(src, ctx, op.width, addrs) != ErrorCode::None) return opcode_handlers[static_cast<int>(Opcode::LD)](ctx, in);
+    const float* mem = src.kind == OpKind::Global ? ctx.globalMem.data() : ctx.block.memory.data();
+    for (int w = 0; w < op.width; w++) {
+        float* row = ctx.warp.reg(op.reg + w);
+        for (int lane = 0; lane < ctx.warp.size(); lane++) {
+            if (laneActive(ctx.mask, lane)) row[lane] = mem[addrs[lane] + w];
+        }
+    }
+    return ErrorCode::None;
+}
+
+ErrorCode store(const ThreadedProgram::Op& op, ExecutionContext& ctx, const DecodedInstr& in)
+{
+    int addrs[MAX_WARP_SIZE];
+    const DecodedOperand& dst = in.src[0];
+    const HandlerFn generic = opcode_handlers[static_cast<int>(Opcode::ST)];
+    if (laneAddresses(dst, ctx, op.width, addrs) != ErrorCode::None) return generic(ctx, in);
+    if (dst.kind == OpKind::Global) {
+        for (int lane = 0; lane < ctx.warp.size(); lane++) {
+            if (laneActive(ctx.mask, lane) && !ctx.globalMem.writable(addrs[lane], op.width)) return generic(ctx, in);
+        }
+        // lane-major, like the generic handler, so pending stores keep their order
+        for (int lane = 0; lane < ctx.warp.size(); lane++) {
+            if (!laneActive(ctx.mask, lane)) continue;
+            for (int w = 0; w < op.width; w++) ctx.globalStores.push_back({addrs[lane] + w, ctx.warp.reg(op.reg + w)[lane]});
+        }
+        return ErrorCode::None;
+    }
+    float* mem = ctx.block.memory.data();
+    for (int w = 0; w < op.width; w++) {
+        const float* row = ctx.warp.reg(op.reg + w);
+        for (int lane = 0; lane < ctx.warp.size(); lane++) {
+            if (laneActive(ctx.mask, lane)) mem[addrs[lane] + w] = row[lane];
+        }
+    }
+    return ErrorCode::None;
+}
+
+void jump(ExecutionContext& ctx)
+{
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane) && ctx.warp.threads[lane]->predicateReg) ctx.taken |= LaneMask(1) << lane;
+    }
+}
+
+void halt(ExecutionContext& ctx)
+{
+    for (int lane = 0; lane < ctx.warp.size(); lane++) {
+        if (laneActive(ctx.mask, lane)) ctx.warp.threads[lane]->active = false;
+    }
+}
+
+} // namespace
+
+// opcode_handlers must be set up (GPU's constructor does it) before
+// translating, since unspecialized instructions point into it.
+ThreadedProgram::ThreadedProgram(const Program& program, int num_registers)
+{
+    code.reserve(program.code.size());
+    for (const auto& in : program.code) {
+        code.push_back(translate(in, num_registers));
+    }
+}
+
+ErrorCode ThreadedProgram::issue(ExecutionContext& ctx, size_t pc) const
+{
+    const Op& op = code[pc];
+    const DecodedInstr& in = ctx.program.code[pc];
+#if defined(__GNUC__)
+    static void* const dispatch[] = { &&do_call, &&do_load, &&do_store, &&do_jump, &&do_nop, &&do_halt };
+    goto *dispatch[op.cls];
+do_call:
+    return op.fn(ctx, in);
+do_load:
+    return load(op, ctx, in);
+do_store:
+    return store(op, ctx, in);
+do_jump:
+    jump(ctx);
+    return ErrorCode::None;
+do_nop:
+    return ErrorCode::None;
+do_halt:
+    halt(ctx);
+    return ErrorCode::None;
+#else
+    switch (op.cls) {
+        case Call: return op.fn(ctx, in);
+        case Load: return load(op, ctx, in);
+        case Store: return store(op, ctx, in);
+        case Jump: jump(ctx); return ErrorCode::None;
+        case Nop: return ErrorCode::None;
+        case Halt: halt(ctx); return ErrorCode::None;
+    }
+    return ErrorCode::None;
+#endif
+}
@@ -0,0 +1,124 @@
+#include "timing.hpp"
+#include "gpu.hpp"
+#include <algorithm>
+
+static_assert(NUM_OPCODES == static_cast<size_t>(Opcode::XOR) + 1, "TimingConfig::ops must cover every opcode");
+
+TimingModel::TimingModel(const TimingConfig& config) : config(config) {}
+
+// Where address register `a` keeps its ready cycle in Warp::regReady, or
+// -1 if the warp has no such register.
+static int addressSlot(const Warp& warp, int a)
+{
+    return a >= 0 && a < warp.num_address_registers ? warp.num_registers + a : -1;
+}
+
+// Latest ready cycle of the registers `o` may touch; an rTIDX operand
+// can touch any rN register, a gm[rN] operand reads rN (gm[aN] aN) and a
+// register operand of a vector LD/ST covers `width` registers from rN.
+static uint64_t registerReady(const Warp& warp, const DecodedOperand& o, int width)
+{
+    if (o.base >= 0) {
+        const int slot = o.baseAddress ? addressSlot(warp, o.base) : o.base < warp.num_registers ? o.base : -1;
+        return slot >= 0 ? warp.regReady[slot] : 0;
+    }
+    if (o.kind == OpKind::Address) {
+        const int slot = addressSlot(warp, o.index);
+        return slot >= 0 ? warp.regReady[slot] : 0;
+    }
+    if (o.kind != OpKind::Register) return 0;
+    if (o.tidx) return *std::max_element(warp.regReady.begin(), warp.regReady.begin() + warp.num_registers);
+    if (o.index < 0 || o.index >= warp.num_registers) return 0;
+    const int end = std::min(o.index + width, warp.num_registers);
+    return *std::max_element(warp.regReady.begin() + o.index, warp.regReady.begin() + end);
+}
+
+// Index into Warp::memReady, or -1 for an operand not in memory.
+static int memorySpace(const DecodedOperand& o)
+{
+    return o.kind == OpKind::Global ? 0 : o.kind == OpKind::Shared ? 1 : -1;
+}
+
+// Whether src[0] is a location the instruction writes (ST's included).
+static bool hasDestination(const DecodedInstr& instr)
+{
+    return instr.numOperands > 0 && (writesDestination(instr.op) || instr.op == Opcode::ST);
+}
+
+uint64_t TimingModel::readyAt(const Warp& warp, const DecodedInstr& instr) const
+{
+    uint64_t at = warp.nextIssue;
+    for (int i = 0; i < instr.numOperands; i++) {
+        at = std::max(at, registerReady(warp, instr.src[i], instr.width));
+        const int space = memorySpace(instr.src[i]);
+        if (space >= 0) at = std::max(at, warp.memReady[space]);
+    }
+    if (instr.op == Opcode::JMP || instr.op == Opcode::CMP_LT) at = std::max(at, warp.predReady);
+    return at;
+}
+
+int TimingModel::memoryLatency(const DecodedInstr& instr, int globalLatency) const
+{
+    if (globalLatency < 0) globalLatency = config.global_latency;
+    int latency = 0;
+    for (int i = hasDestination(instr) ? 1 : 0; i < instr.numOperands; i++) {
+        if (instr.src[i].kind == OpKind::Global) latency = std::max(latency, globalLatency);
+        else if (instr.src[i].kind == OpKind::Shared) latency = std::max(latency, config.shared_latency);
+    }
+    return latency;
+}
+
+uint64_t TimingModel::replayCycles(const MemoryAccess& access) const
+{
+    return static_cast<uint64_t>(access.replays) * config.transaction_cycles +
+           static_cast<uint64_t>(access.bankReplays) * config.bank_conflict_cycles;
+}
+
+uint64_t TimingModel::resultReady(const DecodedInstr& instr, uint64_t cycle, const MemoryAccess& access) const
+{
+    const OpLatency& lat = config.ops[static_cast<int>(instr.op)];
+    return cycle + lat.result + memoryLatency(instr, access.globalLatency) + replayCycles(access);
+}
+
+// Sets the ready cycle of what `instr` writes to `done`, or with `later`
+// only moves it later.
+static void bookResult(Warp& warp, const DecodedInstr& instr, uint64_t done, bool later)
+{
+    auto set = [&](uint64_t& ready) { ready = later ? std::max(ready, done) : done; };
+    if (instr.op == Opcode::CMP_LT) {
+        set(warp.predReady);
+        return;
+    }
+    if (!hasDestination(instr)) return;
+    const DecodedOperand& dst = instr.src[0];
+    const int space = memorySpace(dst);
+    if (space >= 0) {
+        // one ready cycle stands for every pending write in the space
+        warp.memReady[space] = std::max(warp.memReady[space], done);
+        return;
+    }
+    if (dst.kind == OpKind::Address) {
+        const int slot = addressSlot(warp, dst.index);
+        if (slot >= 0) set(warp.regReady[slot]);
+        return;
+    }
+    if (dst.kind != OpKind::Register) return;
+    if (dst.tidx) {
+        for (int r = 0; r < warp.num_registers; r++) set(warp.regReady[r]);
+    } else if (dst.index >= 0 && dst.index < warp.num_registers) {
+        const int end = std::min(dst.index + instr.width, warp.num_registers);
+        for (int r = dst.index; r < end; r++) set(warp.regReady[r]);
+    }
+}
+
+void TimingModel::issue(Warp& warp, const DecodedInstr& instr, uint64_t cycle, const MemoryAccess& access) const
+{
+    const OpLatency& lat = config.ops[static_cast<int>(instr.op)];
+    warp.nextIssue = cycle + lat.issue + replayCycles(access);
+    bookResult(warp, instr, resultReady(instr, cycle, access), false);
+}
+
+void TimingModel::delayResult(Warp& warp, const DecodedInstr& instr, uint64_t until) const
+{
+    bookResult(warp, instr, until, true);
+}
@@ -0,0 +1,84 @@
+#include "trace.hpp"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+static size_t roundUpPow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : size(roundUpPow2(capacity < 1 ? 1 : capacity)), ring(new Slot[size]()), mask(size - 1) {}
+
+TraceBuffer::TraceBuffer(const TraceBuffer& other)
+    : size(other.size), ring(new Slot[other.size]()), mask(other.mask), head(other.head.load())
+{
+    for (size_t s = 0; s < size; s++) {
+        for (size_t i = 0; i < kWords; i++) {
+            ring[s].words[i].store(other.ring[s].words[i].load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+        }
+    }
+}
+
+TraceRecord TraceBuffer::load(uint64_t seq) const
+{
+    uint32_t words[kWords];
+    const Slot& slot = ring[seq & mask];
+    for (size_t i = 0; i < kWords; i++) words[i] = slot.words[i].load(std::memory_order_relaxed);
+    TraceRecord rec;
+    std::memcpy(&rec, words, sizeof(rec));
+    return rec;
+}
+
+uint64_t TraceBuffer::snapshot(std::vector<TraceRecord>& out, uint64_t from) const
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > size ? end - size : 0;
+    if (from > begin) begin = from;
+    size_t first = out.size();
+    for (uint64_t seq = begin; seq < end; seq++) {
+        out.push_back(load(seq));
+    }
+    // Pairs with the fence in push(): if any copied word came from a write
+    // of sequence s, the reload below sees head >= s. The writer may be in
+    // the middle of sequence `now`, which shares a slot with now - size, so
+    // only sequences from now + 1 - size on are known to be intact.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now = head.load(std::memory_order_relaxed);
+    if (now + 1 > size && now + 1 - size > begin) {
+        size_t torn = static_cast<size_t>(std::min(now + 1 - size - begin, end - begin));
+        out.erase(out.begin() + first, out.begin() + first + torn);
+    }
+    return end;
+}
+
+std::string formatTrace(const TraceRecord& rec, const Program& program)
+{
+    std::ostringstream line;
+    line << "[c" << rec.cycle << " SM" << rec.sm << " W" << rec.warp
+         << " 0x" << std::hex << rec.laneMask << std::dec << " pc" << rec.pc << "] ";
+
+    const DecodedInstr* instr = rec.pc < program.code.size() ? &program.code[rec.pc] : nullptr;
+    line << (instr ? mnemonic(*instr) : std::string(opcodeName(static_cast<Opcode>(rec.opcode))));
+    if (instr) {
+        for (int i = 0; i < instr->numOperands; i++) {
+            line << (i == 0 ? " " : ", ") << describeOperand(instr->src[i], program);
+        }
+    }
+    if (rec.hasValues && instr) {
+        const bool dst = writesDestination(instr->op);
+        std::ostringstream values;
+        for (int i = dst ? 1 : 0; i < instr->numOperands; i++) {
+            if (instr->src[i].kind == OpKind::Symbol) continue;
+            values << " " << rec.operands[i];
+        }
+        if (dst) values << " -> " << rec.result;
+        if (!values.str().empty()) line << "  |" << values.str();
+    }
+    if (rec.error) line << "  !error " << static_cast<int>(rec.error);
+    return line.str();
+}
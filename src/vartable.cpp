@@ -1,16 +1,38 @@
 #include "vartable.hpp"
 #include <string>
 
-VarTable& VarTable::getInstance() {
-    static VarTable instance;
-    return instance;
+void VarTable::refresh(const GPU& gpu) {
+    table.clear();
+    for (const auto& sm : gpu.sms) {
+        for (const auto& warp : sm.warps) {
+            const Program& program = gpu.kernelProgram(warp.kernel);
+            for (int slot = 0; slot < static_cast<int>(program.vars.size()); slot++) {
+                for (int lane = 0; lane < warp.size(); lane++) {
+                    int offset = warp.varOffset(slot, lane);
+                    if (offset < 0) continue;
+                    Variable var = program.vars[slot];
+                    var.offset = offset;
+                    switch (var.loc) {
+                        case StoreLoc::GLOBAL:
+                            var.value = offset < static_cast<int>(gpu.global_memory.size()) ? gpu.global_memory[offset] : 0.0f;
+                            break;
+                        case StoreLoc::SHARED: {
+                            const std::vector<float>* shared = warp.block >= 0 ? &sm.blocks[warp.block].memory : nullptr;
+                            var.value = shared && offset < static_cast<int>(shared->size()) ? (*shared)[offset] : 0.0f;
+                            break;
+                        }
+                        case StoreLoc::LOCAL:
+                            var.value = offset < warp.num_registers ? warp.reg(offset)[lane] : 0.0f;
+                            break;
+                    }
+                    table[var.name + "_" + std::to_string(warp.threads[lane]->id())] = var;
+                }
+            }
+        }
+    }
 }
 
-void VarTable::addVar(const Variable& var, int thread_id) {
-    table[var.name + "_" + std::to_string(thread_id)] = var;
-}
-
-std::optional<Variable> VarTable::getVar(const std::string& name, int thread_id) {
+std::optional<Variable> VarTable::getVar(const std::string& name, int thread_id) const {
     auto it = table.find(name + "_" + std::to_string(thread_id));
     if (it != table.end()) return it->second;
     return std::nullopt;
@@ -0,0 +1,102 @@
+#include "workerpool.hpp"
+
+// How many times an idle worker polls for new work before sleeping.
+// Simulation barriers come every cycle, so waking from a condition
+// variable each time would cost more than the work itself.
+constexpr int SPIN_LIMIT = 2000;
+
+WorkerPool::WorkerPool(int num_workers)
+{
+    if (num_workers < 1) num_workers = 1;
+    for (int i = 0; i < num_workers; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (int i = 1; i < num_workers; i++) {
+        workers.emplace_back(&WorkerPool::workerLoop, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& w : workers) w.join();
+}
+
+bool WorkerPool::runOne(int self)
+{
+    int task = -1;
+    const int n = size();
+    for (int k = 0; k < n && task < 0; k++) {
+        Queue& q = *queues[(self + k) % n];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.tasks.empty()) continue;
+        if (k == 0) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        } else {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        }
+    }
+    if (task < 0) return false;
+
+    try {
+        (*job)(task);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!error) error = std::current_exception();
+    }
+    if (remaining.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lock(mtx);
+        done.notify_all();
+    }
+    return true;
+}
+
+void WorkerPool::workerLoop(int self)
+{
+    unsigned long seen = 0;
+    while (true) {
+        int spins = 0;
+        while (generation.load() == seen && !stopping) {
+            if (++spins < SPIN_LIMIT) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mtx);
+            wake.wait(lock, [&] { return generation.load() != seen || stopping; });
+        }
+        if (stopping) return;
+        seen = generation.load();
+        while (runOne(self)) {}
+    }
+}
+
+void WorkerPool::parallel_for(int count, const std::function<void(int)>& fn)
+{
+    if (count <= 0) return;
+    job = &fn;
+    error = nullptr;
+    remaining = count;
+    for (int i = 0; i < count; i++) {
+        Queue& q = *queues[i % size()];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        q.tasks.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        generation++;
+    }
+    wake.notify_all();
+
+    while (runOne(0)) {}
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [&] { return remaining.load() == 0; });
+    }
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,79 @@
+// Restore must either reject a damaged checkpoint and leave the GPU as it
+// was, or accept it and keep running without reading out of bounds.
+// Build and run with `make check`.
+#include "gpu.hpp"
+#include "counters.hpp"
+#include "kernels.hpp"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+static std::string state(GPU& gpu)
+{
+    std::ostringstream out;
+    writeCountersJson(out, gpu);
+    for (float v : gpu.global_memory) out << v << ",";
+    out << gpu.get_cycle();
+    return out.str();
+}
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string& what)
+{
+    if (ok) return;
+    std::cerr << "FAIL: " << what << "\n";
+    failures++;
+}
+
+// Restores `bad`; a rejected blob must leave `gpu` exactly at `before`.
+static void tryRestore(GPU& gpu, const std::string& bad, const std::string& before, const std::string& what)
+{
+    if (!gpu.restore(bad)) {
+        expect(state(gpu) == before, what + " changed the GPU although it was rejected");
+        return;
+    }
+    // accepted: whatever it holds has to be safe to run for a while, though
+    // a kernel fault on the damaged values is fine
+    try {
+        for (int i = 0; i < 200 && gpu.step(); i++) {
+        }
+    } catch (const std::runtime_error&) {
+    }
+}
+
+int main()
+{
+    // with caches the blob is mostly cache tags; without, every byte is tried
+    for (SchedulerPolicy policy : {SchedulerPolicy::LooseRoundRobin, SchedulerPolicy::TwoLevel}) {
+        GpuConfig config;
+        config.num_sms = 2;
+        config.warps_per_sm = 6;
+        config.warp_size = 8;
+        config.global_mem_bytes = 1024;
+        config.timing.enabled = true;
+        config.caches = policy == SchedulerPolicy::LooseRoundRobin;
+        config.scheduler = policy;
+        GPU gpu(loopKernel(), config);
+        for (int i = 0; i < 100; i++) gpu.step();
+        const std::string blob = gpu.checkpoint();
+        const std::string before = state(gpu);
+        const std::string name = schedulerName(policy);
+
+        // a few thousand cuts and single-bit flips spread over the whole blob
+        const size_t stride = blob.size() / 3000 + 1;
+        for (size_t len = 0; len < blob.size(); len += stride) {
+            tryRestore(gpu, blob.substr(0, len), before, name + " blob cut to " + std::to_string(len));
+        }
+        for (size_t at = 0; at < blob.size(); at += stride) {
+            std::string bad = blob;
+            bad[at] = static_cast<char>(bad[at] ^ (1 << at % 8));
+            tryRestore(gpu, bad, before, name + " flip in byte " + std::to_string(at));
+            expect(gpu.restore(blob), name + " original blob no longer restores");
+        }
+        expect(gpu.restore(blob) && state(gpu) == before, name + " round trip");
+    }
+    if (failures) return 1;
+    std::cout << "checkpoint_test: ok\n";
+    return 0;
+}